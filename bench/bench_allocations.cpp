@@ -0,0 +1,103 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <benchmark/benchmark.h>
+
+#include <utils.hpp>
+#include <court.hpp>
+#include <synthetic.hpp>
+#include <courtdetector.hpp>
+#include "fixtures.hpp"
+
+
+/**
+ * Number of calls to the global operator new of the whole program, including
+ * the libraries (OpenCV allocates the UMatData of each cv::Mat buffer with
+ * new, so new cv::Mat buffers are counted too). The replacement adds a relaxed
+ * atomic increment to every allocation of the other benchmarks.
+*/
+static std::atomic<size_t> allocations(0);
+
+void* operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *pointer = std::malloc(size > 0 ? size : 1);
+    if (pointer == nullptr)
+        throw std::bad_alloc();
+    return pointer;
+}
+
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+
+/**
+ * Runs the detector on `images` in a loop, after a warm-up pass over all of
+ * them, and reports the number of allocations per image. Fails if the steady
+ * state allocates.
+*/
+static void run_steady_state(benchmark::State& state, CourtDetector& detector, std::vector<cv::Mat>& images)
+{
+    Calib calib;
+    for (cv::Mat& image : images)
+        detector(image, calib);
+
+    size_t index = 0;
+    size_t before = allocations.load();
+    for (auto _ : state)
+    {
+        detector(images[index], calib);
+        index = (index + 1) % images.size();
+    }
+    size_t count = allocations.load() - before;
+
+    state.counters["allocations"] = benchmark::Counter(count, benchmark::Counter::kAvgIterations);
+    state.SetItemsProcessed(state.iterations());
+    if (count > 0)
+        state.SkipWithError((std::to_string(count) + " allocations after warm-up").c_str());
+}
+
+/**
+ * Full detection on the reference image.
+*/
+static void BM_Allocations(benchmark::State& state)
+{
+    Court court("ITF");
+    std::vector<cv::Mat> images = {reference_image().clone()};
+    CourtDetector detector(court, images[0].size());
+    run_steady_state(state, detector, images);
+}
+BENCHMARK(BM_Allocations)->Unit(benchmark::kMillisecond);
+
+/**
+ * Tracking on the reference image repeated, with both line searches.
+*/
+static void BM_Allocations_tracking(benchmark::State& state)
+{
+    Court court("ITF");
+    std::vector<cv::Mat> images = {reference_image().clone()};
+    CourtDetector detector(court, images[0].size(), false, true, (LineTracking)state.range(0));
+    run_steady_state(state, detector, images);
+}
+BENCHMARK(BM_Allocations_tracking)->Arg(profile_tracking)->Arg(hough_tracking)->Unit(benchmark::kMillisecond);
+
+/**
+ * Full detection on a loop of different 1080p synthetic renderings, so that
+ * the number of pixels, segments and lines changes from one image to the next.
+*/
+static void BM_Allocations_synthetic(benchmark::State& state)
+{
+    Court court("ITF");
+    cv::Size size(1920, 1080);
+    SyntheticParameters parameters = broadcast_camera;
+    parameters.blur_max = 0;
+    SyntheticGenerator generator(court, size, parameters);
+    std::vector<cv::Mat> images(8);
+    for (cv::Mat& image : images)
+        generator(image);
+    CourtDetector detector(court, size);
+    run_steady_state(state, detector, images);
+}
+BENCHMARK(BM_Allocations_synthetic)->Unit(benchmark::kMillisecond);
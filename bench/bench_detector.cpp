@@ -0,0 +1,369 @@
+#include <cmath>
+#include <future>
+#include <limits>
+#include <memory>
+#include <vector>
+#include <stdlib.h>
+#include <benchmark/benchmark.h>
+
+#include <utils.hpp>
+#include <court.hpp>
+#include <synthetic.hpp>
+#include <debugsink.hpp>
+#include <courtdetector.hpp>
+#include <batchdetector.hpp>
+#include <pipelinedetector.hpp>
+#include "fixtures.hpp"
+
+
+static const cv::Size resolutions[] = {cv::Size(1280, 720), cv::Size(1920, 1080), cv::Size(3840, 2160)};
+
+
+/**
+ * Full detection on the reference image.
+*/
+static void BM_CourtDetector(benchmark::State& state)
+{
+    Court court("ITF");
+    cv::Mat image = reference_image().clone();
+    CourtDetector detector(court, image.size());
+    for (auto _ : state)
+        benchmark::DoNotOptimize(detector(image));
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CourtDetector)->Unit(benchmark::kMillisecond);
+
+/**
+ * Full detection on the reference image with the debug layers submitted to an
+ * AsyncDebugSink writing PNG files in a temporary directory (range(0) = 1) or
+ * without debug (range(0) = 0). Reports the fraction of dropped images.
+*/
+static void BM_CourtDetector_debug(benchmark::State& state)
+{
+    Court court("ITF");
+    cv::Mat image = reference_image().clone();
+    CourtDetector detector(court, image.size());
+    char directory[] = "/tmp/court_debug_XXXXXX";
+    std::unique_ptr<AsyncDebugSink> sink;
+    if (state.range(0))
+    {
+        if (mkdtemp(directory) == nullptr)
+        {
+            state.SkipWithError("could not create the debug directory");
+            return;
+        }
+        sink.reset(new AsyncDebugSink(directory));
+        detector.set_debug_sink(sink.get());
+    }
+    for (auto _ : state)
+        benchmark::DoNotOptimize(detector(image));
+    state.SetItemsProcessed(state.iterations());
+    if (sink)
+    {
+        sink->close();
+        state.counters["dropped"] = (double)sink->dropped()/sink->submitted();
+        state.SetLabel(directory);
+    }
+}
+BENCHMARK(BM_CourtDetector_debug)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+/**
+ * Tracking of the lines from the previous calibration, on the reference image
+ * repeated (i.e. a still camera).
+*/
+static void BM_CourtDetector_tracking(benchmark::State& state)
+{
+    Court court("ITF");
+    cv::Mat image = reference_image().clone();
+    LineTracking line_tracking = (LineTracking)state.range(0);
+    CourtDetector detector(court, image.size(), false, true, line_tracking);
+    detector(image); // full detection
+    for (auto _ : state)
+        benchmark::DoNotOptimize(detector(image));
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(line_tracking == profile_tracking ? "profile" : "hough");
+}
+BENCHMARK(BM_CourtDetector_tracking)->Arg(profile_tracking)->Arg(hough_tracking)->Unit(benchmark::kMillisecond);
+
+/**
+ * Full detection on synthetic renderings: range(0) indexes `resolutions` and
+ * range(1) is the number of clutter spots.
+*/
+static void BM_CourtDetector_synthetic(benchmark::State& state)
+{
+    Court court("ITF");
+    cv::Size size = resolutions[state.range(0)];
+    SyntheticParameters parameters = broadcast_camera;
+    parameters.blur_max = 0;
+    parameters.clutter = state.range(1);
+    cv::Mat image;
+    SyntheticGenerator(court, size, parameters)(image);
+    CourtDetector detector(court, size);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(detector(image));
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(std::to_string(size.width) + "x" + std::to_string(size.height));
+}
+BENCHMARK(BM_CourtDetector_synthetic)
+    ->ArgNames({"resolution", "clutter"})
+    ->ArgsProduct({{0, 1, 2}, {0, 200, 2000}})
+    ->Unit(benchmark::kMillisecond);
+
+/**
+ * Full detection on a pyramid level of synthetic renderings: range(0) indexes
+ * `resolutions` and range(1) is the number of pyramid levels. Besides the
+ * latency, reports the mean distance to the ground truth calibration
+ * ("error_px", see reprojection_distance) and the fraction of failed
+ * detections, measured on a separate pass over the images.
+*/
+static void BM_CourtDetector_pyramid(benchmark::State& state)
+{
+    Court court("ITF");
+    cv::Size size = resolutions[state.range(0)];
+    int pyramid_levels = state.range(1);
+    SyntheticParameters parameters = broadcast_camera;
+    SyntheticGenerator generator(court, size, parameters);
+    std::vector<cv::Mat> images(8);
+    std::vector<Calib> truths;
+    for (cv::Mat& image : images)
+        truths.push_back(generator(image));
+    CourtDetector detector(court, size, false, false, profile_tracking, pyramid_levels);
+
+    size_t index = 0;
+    for (auto _ : state)
+    {
+        try
+        {
+            benchmark::DoNotOptimize(detector(images[index]));
+        }
+        catch (std::exception& e) {}
+        index = (index + 1) % images.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+
+    double error = 0;
+    int failures = 0;
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        double distance = std::numeric_limits<double>::infinity();
+        try
+        {
+            distance = reprojection_distance(court, truths[i].P, detector(images[i]).P, size);
+        }
+        catch (std::exception& e) {}
+        if (distance <= 5)
+            error += distance;
+        else
+            failures++;
+    }
+    state.counters["error_px"] = failures < (int)images.size() ? error/(images.size() - failures) : NAN;
+    state.counters["failures"] = (double)failures/images.size();
+    state.SetLabel(std::to_string(size.width) + "x" + std::to_string(size.height));
+}
+BENCHMARK(BM_CourtDetector_pyramid)
+    ->ArgNames({"resolution", "levels"})
+    ->ArgsProduct({{1, 2}, {0, 1, 2}})
+    ->Unit(benchmark::kMillisecond);
+
+/**
+ * Full detection on synthetic renderings of each court type: range(0) indexes
+ * Court::rule_types. Reports the latency, the mean distance to the ground truth
+ * calibration ("error_px") and the fraction of failed detections as
+ * BM_CourtDetector_pyramid, and fails if the court is not identified on most
+ * images.
+*/
+static void BM_CourtDetector_courts(benchmark::State& state)
+{
+    std::string rule_type = Court::rule_types()[state.range(0)];
+    Court court(rule_type);
+    cv::Size size = resolutions[1];
+    SyntheticGenerator generator(court, size, broadcast_camera);
+    std::vector<cv::Mat> images(8);
+    std::vector<Calib> truths;
+    for (cv::Mat& image : images)
+        truths.push_back(generator(image));
+    CourtDetector detector(court, size);
+
+    double error = 0;
+    int failures = 0;
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        double distance = std::numeric_limits<double>::infinity();
+        try
+        {
+            distance = reprojection_distance(court, truths[i].P, detector(images[i]).P, size);
+        }
+        catch (std::exception& e) {}
+        if (distance <= 5)
+            error += distance;
+        else
+            failures++;
+    }
+    state.SetLabel(rule_type);
+    if (2*failures > (int)images.size())
+    {
+        state.SkipWithError(("the " + rule_type + " court is not identified on most synthetic images").c_str());
+        return;
+    }
+
+    size_t index = 0;
+    for (auto _ : state)
+    {
+        try
+        {
+            benchmark::DoNotOptimize(detector(images[index]));
+        }
+        catch (std::exception& e) {}
+        index = (index + 1) % images.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["error_px"] = failures < (int)images.size() ? error/(images.size() - failures) : NAN;
+    state.counters["failures"] = (double)failures/images.size();
+}
+BENCHMARK(BM_CourtDetector_courts)->DenseRange(0, 3)->Unit(benchmark::kMillisecond);
+
+/**
+ * Synthetic renderings of the ITF court at 1080p, generated once.
+*/
+static const std::vector<cv::Mat>& synthetic_frames()
+{
+    static const std::vector<cv::Mat> frames = [] {
+        SyntheticGenerator generator(Court("ITF"), resolutions[1], broadcast_camera);
+        std::vector<cv::Mat> images(16);
+        for (cv::Mat& image : images)
+            generator(image);
+        return images;
+    }();
+    return frames;
+}
+
+/**
+ * Projection matrix computed by `detect`, empty if the detection failed.
+*/
+template<typename Detect>
+static cv::Mat detected_projection(Detect detect)
+{
+    try
+    {
+        return detect().P;
+    }
+    catch (std::exception& e)
+    {
+        return cv::Mat();
+    }
+}
+
+static bool same_projection(const cv::Mat& a, const cv::Mat& b)
+{
+    return a.empty() ? b.empty() : !b.empty() && cv::norm(a, b, cv::NORM_INF) == 0;
+}
+
+/**
+ * Projection matrices computed by a CourtDetector processing `frames` in
+ * order, the reference of the concurrent detectors.
+*/
+static std::vector<cv::Mat> sequential_projections(const std::vector<cv::Mat>& frames, bool tracking)
+{
+    CourtDetector detector(Court("ITF"), frames[0].size(), false, tracking);
+    std::vector<cv::Mat> projections;
+    for (cv::Mat image : frames)
+        projections.push_back(detected_projection([&] { return detector(image); }));
+    return projections;
+}
+
+/**
+ * Detection on several streams of cached synthetic frames with a BatchDetector:
+ * range(0) is the number of streams and range(1) the number of threads. Each
+ * stream tracks the lines of the same frames: the calibrations of a first pass
+ * must be equal to those of a single CourtDetector.
+*/
+static void BM_BatchDetector(benchmark::State& state)
+{
+    const std::vector<cv::Mat>& frames = synthetic_frames();
+    int streams = state.range(0);
+    BatchDetector batch(state.range(1));
+    for (int i = 0; i < streams; i++)
+        batch.add_stream(Court("ITF"), frames[0].size(), true);
+
+    auto process = [&](std::vector<cv::Mat> *projections) {
+        std::vector<std::future<Calib>> futures;
+        for (size_t f = 0; f < frames.size(); f++)
+        {
+            for (int i = 0; i < streams; i++)
+                futures.push_back(batch.submit(i, frames[f]));
+        }
+        for (size_t j = 0; j < futures.size(); j++)
+        {
+            cv::Mat P = detected_projection([&] { return futures[j].get(); });
+            if (projections != nullptr)
+                projections[j % streams].push_back(P);
+        }
+    };
+
+    std::vector<cv::Mat> reference = sequential_projections(frames, true);
+    std::vector<std::vector<cv::Mat>> projections(streams);
+    process(projections.data());
+    for (int i = 0; i < streams; i++)
+    {
+        for (size_t f = 0; f < frames.size(); f++)
+        {
+            if (!same_projection(projections[i][f], reference[f]))
+            {
+                state.SkipWithError("the batch calibrations differ from CourtDetector");
+                return;
+            }
+        }
+    }
+
+    for (auto _ : state)
+        process(nullptr);
+    state.SetItemsProcessed(state.iterations()*streams*frames.size());
+}
+BENCHMARK(BM_BatchDetector)
+    ->ArgNames({"streams", "threads"})
+    ->ArgsProduct({{1, 2, 4, 8}, {1, 2, 4, 8}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+/**
+ * Full detection of cached synthetic frames with a PipelineDetector: range(0)
+ * is the depth of the queues. As many images as the pipeline holds are kept
+ * in flight. The calibrations of a first pass must be equal to those of a
+ * CourtDetector without tracking, in push order.
+*/
+static void BM_PipelineDetector(benchmark::State& state)
+{
+    const std::vector<cv::Mat>& frames = synthetic_frames();
+    PipelineDetector pipeline(Court("ITF"), frames[0].size(), state.range(0));
+    size_t in_flight = std::min(pipeline.capacity(), frames.size());
+
+    auto process = [&](std::vector<cv::Mat> *projections) {
+        for (size_t f = 0; f < frames.size() + in_flight; f++)
+        {
+            if (f >= in_flight)
+            {
+                cv::Mat P = detected_projection([&] { return pipeline.pop(); });
+                if (projections != nullptr)
+                    projections->push_back(P);
+            }
+            if (f < frames.size())
+                pipeline.push(frames[f]);
+        }
+    };
+
+    std::vector<cv::Mat> reference = sequential_projections(frames, false), projections;
+    process(&projections);
+    for (size_t f = 0; f < frames.size(); f++)
+    {
+        if (!same_projection(projections[f], reference[f]))
+        {
+            state.SkipWithError("the pipeline calibrations differ from CourtDetector");
+            return;
+        }
+    }
+
+    for (auto _ : state)
+        process(nullptr);
+    state.SetItemsProcessed(state.iterations()*frames.size());
+}
+BENCHMARK(BM_PipelineDetector)->ArgName("depth")->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime()->Unit(benchmark::kMillisecond);
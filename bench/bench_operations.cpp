@@ -0,0 +1,462 @@
+#include <cmath>
+#include <string>
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <Eigen/Dense>
+#include <benchmark/benchmark.h>
+#include <opencv2/ximgproc.hpp>
+
+#include <utils.hpp>
+#include <court.hpp>
+#include <operations.hpp>
+#include <thinning.hpp>
+#include <homography.hpp>
+#include <lineexporter.hpp>
+#include "fixtures.hpp"
+
+
+/**
+ * Inputs of each operation on the reference image, computed once with the
+ * same parameters as CourtDetector.
+*/
+struct ReferenceInputs
+{
+    ReferenceInputs():
+        court("ITF")
+    {
+        this->image = reference_image();
+        this->skeleton = Skeletonize(this->court, this->image.size(), 128, 20)(this->image);
+        this->cleaned = RemoveSmallComponents(50)(this->skeleton.clone());
+        this->segments = FindSegments(1, 1, 10, 100, 100)(this->cleaned);
+        this->lines = ClusterSegments(50, 5)(this->segments);
+        RefineLines(5, 5, 32, 0.5)(this->image, this->lines);
+        this->labeled_lines = IdentifyLines(this->court, 20)(this->lines);
+        this->calib.reset(new Calib(ComputeHomography(this->court, this->image.size())(this->labeled_lines)));
+    }
+    Court court;
+    cv::Mat image, skeleton, cleaned;
+    std::vector<LineSegment> segments, lines, labeled_lines;
+    std::unique_ptr<Calib> calib;
+};
+
+static const ReferenceInputs& inputs()
+{
+    static const ReferenceInputs inputs;
+    return inputs;
+}
+
+
+// range(0): 0 for a plain threshold, 1 for the court line filter
+static void BM_Skeletonize(benchmark::State& state)
+{
+    Skeletonize skeletonize = state.range(0) ? Skeletonize(inputs().court, inputs().image.size(), 128, 20) : Skeletonize();
+    cv::Mat output;
+    for (auto _ : state)
+        skeletonize(inputs().image, output);
+    state.SetLabel(state.range(0) ? "line filter" : "threshold");
+}
+BENCHMARK(BM_Skeletonize)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+// Reference implementation replaced by Skeletonize
+static void BM_Skeletonize_ximgproc(benchmark::State& state)
+{
+    cv::Mat output;
+    for (auto _ : state)
+        cv::ximgproc::thinning(inputs().image, output);
+}
+BENCHMARK(BM_Skeletonize_ximgproc)->Unit(benchmark::kMillisecond);
+
+/**
+ * Binarizes `image` with `filter` one pixel at a time (see LineFilter), as a
+ * reference for the vectorized binarization of Thinning.
+*/
+static cv::Mat binarize_reference(const cv::Mat& image, LineFilter filter)
+{
+    cv::Mat binary = cv::Mat::zeros(image.size(), CV_8UC1);
+    int w = filter.width;
+    for (int y = 0; y < image.rows; y++)
+    for (int x = 0; x < image.cols; x++)
+    {
+        int c = image.at<uchar>(y, x);
+        int horizontal = 0, vertical = 0;
+        if (x - w >= 0 && x + w < image.cols)
+            horizontal = std::min(c - image.at<uchar>(y, x - w), c - image.at<uchar>(y, x + w));
+        if (y - w >= 0 && y + w < image.rows)
+            vertical = std::min(c - image.at<uchar>(y - w, x), c - image.at<uchar>(y + w, x));
+        if (c >= filter.threshold && std::max(std::max(horizontal, vertical), 0) >= filter.contrast)
+            binary.at<uchar>(y, x) = 255;
+    }
+    return binary;
+}
+
+/**
+ * Checks that Thinning produces the skeleton of `cv::ximgproc::thinning` bit
+ * for bit on the reference image, binarized with a plain threshold (range(0) =
+ * 0, ximgproc's own binarization) or the court line filter (range(0) = 1,
+ * binarized by binarize_reference beforehand). The benchmark fails if any
+ * pixel differs, and otherwise measures Thinning.
+*/
+static void BM_Thinning_ximgproc_check(benchmark::State& state)
+{
+    LineFilter filter = state.range(0) ? LineFilter{128, 20, 8} : LineFilter{128, 0, 0};
+    const cv::Mat& image = inputs().image;
+    cv::Mat expected, output;
+    cv::ximgproc::thinning(state.range(0) ? binarize_reference(image, filter) : image, expected);
+    Thinning thinning(filter);
+    thinning(image, output);
+    int differences = cv::countNonZero(output != expected);
+    if (differences > 0)
+    {
+        state.SkipWithError((std::to_string(differences) + " pixels differ from cv::ximgproc::thinning").c_str());
+        return;
+    }
+    for (auto _ : state)
+        thinning(image, output);
+    state.SetLabel(state.range(0) ? "line filter" : "threshold");
+}
+BENCHMARK(BM_Thinning_ximgproc_check)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+static void BM_RemoveSmallComponents(benchmark::State& state)
+{
+    RemoveSmallComponents remove_small_components(50);
+    cv::Mat binary;
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        inputs().skeleton.copyTo(binary); // the operation works in place
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(remove_small_components(binary));
+    }
+}
+BENCHMARK(BM_RemoveSmallComponents)->Unit(benchmark::kMillisecond);
+
+static void BM_FindSegments(benchmark::State& state)
+{
+    FindSegments find_segments(1, 1, 10, 100, 100);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(find_segments(inputs().cleaned));
+    state.counters["segments"] = inputs().segments.size();
+}
+BENCHMARK(BM_FindSegments)->Unit(benchmark::kMillisecond);
+
+// Reference implementation replaced by HoughSegments
+static void BM_FindSegments_opencv(benchmark::State& state)
+{
+    std::vector<cv::Vec4i> segments;
+    for (auto _ : state)
+        cv::HoughLinesP(inputs().cleaned, segments, 1, CV_PI/180, 10, 100, 100);
+}
+BENCHMARK(BM_FindSegments_opencv)->Unit(benchmark::kMillisecond);
+
+static void BM_ClusterSegments(benchmark::State& state)
+{
+    ClusterSegments cluster_segments(50, 5);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(cluster_segments(inputs().segments));
+    state.counters["clusters"] = inputs().lines.size();
+}
+BENCHMARK(BM_ClusterSegments)->Unit(benchmark::kMicrosecond);
+
+/**
+ * `count` segments in a 1920x1080 image: 80% are pieces of 12 random lines
+ * (jittered by up to 2 pixels across the line), the others random clutter.
+*/
+static std::vector<LineSegment> synthetic_segments(int count, unsigned seed=0)
+{
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<float> uniform(0, 1);
+    std::vector<cv::Point2f> origins, directions;
+    for (int l = 0; l < 12; l++)
+    {
+        float angle = CV_PI*uniform(generator);
+        origins.push_back(cv::Point2f(1920*uniform(generator), 1080*uniform(generator)));
+        directions.push_back(cv::Point2f(std::cos(angle), std::sin(angle)));
+    }
+    std::vector<LineSegment> segments;
+    for (int i = 0; i < count; i++)
+    {
+        if (uniform(generator) < 0.8)
+        {
+            int l = generator() % origins.size();
+            cv::Point2f normal(-directions[l].y, directions[l].x);
+            float t = 1000*(uniform(generator) - 0.5f), length = 20 + 180*uniform(generator);
+            cv::Point2f p1 = origins[l] + t*directions[l] + 4*(uniform(generator) - 0.5f)*normal;
+            cv::Point2f p2 = origins[l] + (t + length)*directions[l] + 4*(uniform(generator) - 0.5f)*normal;
+            segments.push_back(LineSegment(p1.x, p1.y, p2.x, p2.y));
+        }
+        else
+        {
+            segments.push_back(LineSegment(1920*uniform(generator), 1080*uniform(generator),
+                                           1920*uniform(generator), 1080*uniform(generator)));
+        }
+    }
+    return segments;
+}
+
+/**
+ * Baseline clustering replaced by ClusterSegments: the adjacency matrix of the
+ * segments is multiplied by itself until its transitive closure is reached,
+ * and the clusters are read from the rows of the closure. The lines aren't
+ * fitted to the clusters, which only favors the baseline. The baseline used an
+ * integer matrix, whose path counts overflow on large sets: doubles are used
+ * instead, only their non-zero pattern matters.
+ * @return the cluster of each segment, clusters being numbered in the order of
+ * their first segment as in ClusterSegments::segment_lines.
+*/
+static std::vector<int> matrix_closure_clusters(const std::vector<LineSegment>& segments, float rho_threshold, float theta_threshold)
+{
+    int n = segments.size();
+    Eigen::MatrixXd adjacency = Eigen::MatrixXd::Zero(n, n);
+    for (int i = 0; i < n; ++i)
+    {
+        adjacency(i, i) = 1;
+        for (int j = i+1; j < n; ++j)
+        {
+            double rho   = std::abs(segments[i].rho - segments[j].rho);
+            double theta = std::abs(std::fmod(segments[i].theta - segments[j].theta, CV_PI))*180/CV_PI;
+            if (rho < rho_threshold && theta < theta_threshold)
+            {
+                adjacency(i, j) = 1;
+                adjacency(j, i) = 1;
+            }
+        }
+    }
+
+    Eigen::MatrixXd connected = adjacency;
+    while (true)
+    {
+        Eigen::MatrixXd new_connected = connected*adjacency;
+        if ((connected.array() != 0).matrix() == (new_connected.array() != 0).matrix())
+            break;
+        // Normalized to keep the path counts finite
+        connected = (new_connected.array() != 0).cast<double>().matrix();
+    }
+
+    std::vector<int> clusters(n, -1);
+    int count = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (clusters[i] >= 0)
+            continue;
+        for (int j = i; j < n; j++)
+        {
+            if (connected(i, j) != 0)
+                clusters[j] = count;
+        }
+        count++;
+    }
+    return clusters;
+}
+
+// The closure is cubic in the number of segments: the baseline is only run up
+// to this number of segments
+static const int max_baseline_segments = 1000;
+
+/**
+ * Checks that ClusterSegments partitions `segments` as the baseline does.
+*/
+static bool same_clusters(benchmark::State& state, const std::vector<LineSegment>& segments, const ClusterSegments& cluster_segments)
+{
+    if (cluster_segments.segment_lines() != matrix_closure_clusters(segments, 50, 5))
+    {
+        state.SkipWithError("the clusters differ from the matrix closure baseline");
+        return false;
+    }
+    return true;
+}
+
+// range(0): number of segments. The clusters are checked against the baseline
+// up to max_baseline_segments.
+static void BM_ClusterSegments_synthetic(benchmark::State& state)
+{
+    std::vector<LineSegment> segments = synthetic_segments(state.range(0)), lines;
+    ClusterSegments cluster_segments(50, 5);
+    cluster_segments(segments, lines);
+    if (state.range(0) <= max_baseline_segments && !same_clusters(state, segments, cluster_segments))
+        return;
+    for (auto _ : state)
+        cluster_segments(segments, lines);
+    state.counters["clusters"] = lines.size();
+}
+BENCHMARK(BM_ClusterSegments_synthetic)->Arg(100)->Arg(500)->Arg(1000)->Arg(2000)->Arg(5000)->Unit(benchmark::kMicrosecond);
+
+// range(0): number of segments
+static void BM_ClusterSegments_matrix(benchmark::State& state)
+{
+    std::vector<LineSegment> segments = synthetic_segments(state.range(0)), lines;
+    ClusterSegments cluster_segments(50, 5);
+    cluster_segments(segments, lines);
+    if (!same_clusters(state, segments, cluster_segments))
+        return;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(matrix_closure_clusters(segments, 50, 5));
+    state.counters["clusters"] = lines.size();
+}
+BENCHMARK(BM_ClusterSegments_matrix)->Arg(100)->Arg(500)->Arg(max_baseline_segments)->Unit(benchmark::kMicrosecond);
+
+static void BM_RefineLines(benchmark::State& state)
+{
+    RefineLines refine_lines(5, 5, 32, 0.5);
+    std::vector<LineSegment> lines;
+    for (auto _ : state)
+    {
+        lines = inputs().lines; // reuses the capacity
+        refine_lines(inputs().image, lines);
+    }
+}
+BENCHMARK(BM_RefineLines)->Unit(benchmark::kMicrosecond);
+
+static void BM_IdentifyLines(benchmark::State& state)
+{
+    IdentifyLines identify_lines(inputs().court, 20);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(identify_lines(inputs().lines));
+}
+BENCHMARK(BM_IdentifyLines)->Unit(benchmark::kMicrosecond);
+
+static void BM_TrackLines(benchmark::State& state)
+{
+    TrackLines track_lines(inputs().court, 10, 50, 0.5, 128);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(track_lines(inputs().image, *inputs().calib));
+}
+BENCHMARK(BM_TrackLines)->Unit(benchmark::kMicrosecond);
+
+static void BM_SearchLines(benchmark::State& state)
+{
+    SearchLines search_lines(inputs().court, 10, 3, 1, 0.25, 0.5, 128);
+    std::vector<LineSegment> lines;
+    for (auto _ : state)
+        search_lines(inputs().image, *inputs().calib, lines);
+    state.counters["lines"] = lines.size();
+}
+BENCHMARK(BM_SearchLines)->Unit(benchmark::kMicrosecond);
+
+static void BM_ComputeHomography(benchmark::State& state)
+{
+    HomographySolver solver = (HomographySolver)state.range(0);
+    ComputeHomography compute_homography(inputs().court, inputs().image.size(), solver);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(compute_homography(inputs().labeled_lines));
+    state.SetLabel(solver == closed_form ? "closed_form" : "calibrate_camera");
+}
+BENCHMARK(BM_ComputeHomography)->Arg(closed_form)->Arg(calibrate_camera_solver)->Unit(benchmark::kMicrosecond);
+
+static void BM_RefineCalibration(benchmark::State& state)
+{
+    RefineCalibration refine_calibration(inputs().court, inputs().image.size(), 10, 20, 1.5, 20);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(refine_calibration(*inputs().calib, inputs().lines));
+}
+BENCHMARK(BM_RefineCalibration)->Unit(benchmark::kMicrosecond);
+
+static void BM_ValidateCalibration(benchmark::State& state)
+{
+    ValidateCalibration validate_calibration(inputs().court, inputs().image.size(), 3, 50, 128, 20);
+    CalibQuality quality;
+    for (auto _ : state)
+        validate_calibration(inputs().image, *inputs().calib, quality);
+    state.counters["support"] = quality.support;
+}
+BENCHMARK(BM_ValidateCalibration)->Unit(benchmark::kMicrosecond);
+
+static void BM_CalibProject(benchmark::State& state)
+{
+    Court court = inputs().court;
+    std::vector<cv::Point3f> line = court.line("baseline"), points;
+    for (int i = 0; i < state.range(0); i++)
+        points.push_back(line[0] + (float)i/state.range(0)*(line[1] - line[0]));
+    Calib calib = *inputs().calib;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(calib.project(points));
+    state.SetItemsProcessed(state.iterations()*points.size());
+}
+BENCHMARK(BM_CalibProject)->RangeMultiplier(10)->Range(10, 1000000)->Unit(benchmark::kMicrosecond);
+
+/**
+ * Court plane points on a grid covering the court and its surroundings, in
+ * structure of arrays, for the batched projections.
+*/
+static void court_grid(size_t count, std::vector<float>& x, std::vector<float>& y, std::vector<float>& z)
+{
+    x.resize(count);
+    y.resize(count);
+    z.assign(count, 0);
+    size_t side = std::max<size_t>(1, std::sqrt(count));
+    for (size_t i = 0; i < count; i++)
+    {
+        x[i] = -2 + 15*(float)(i % side)/side;
+        y[i] = -5 + 34*(float)(i / side)/side;
+    }
+}
+
+// Batched version of BM_CalibProject, in structure of arrays
+static void BM_CalibProject_batch(benchmark::State& state)
+{
+    std::vector<float> x, y, z, u(state.range(0)), v(state.range(0));
+    court_grid(state.range(0), x, y, z);
+    Calib calib = *inputs().calib;
+    for (auto _ : state)
+    {
+        calib.project(x.data(), y.data(), z.data(), x.size(), u.data(), v.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*x.size());
+}
+BENCHMARK(BM_CalibProject_batch)->RangeMultiplier(10)->Range(10, 1000000)->Unit(benchmark::kMicrosecond);
+
+// Baseline of BM_CalibProject_batch: cv::projectPoints on the same points, with
+// the calibration parameters
+static void BM_CalibProject_opencv(benchmark::State& state)
+{
+    std::vector<float> x, y, z;
+    court_grid(state.range(0), x, y, z);
+    std::vector<cv::Point3f> points(x.size());
+    for (size_t i = 0; i < x.size(); i++)
+        points[i] = cv::Point3f(x[i], y[i], z[i]);
+    const Calib& calib = *inputs().calib;
+    std::vector<cv::Point2f> projected;
+    for (auto _ : state)
+    {
+        cv::projectPoints(points, calib.rotation_vector(), calib.translation_vector(), calib.camera_matrix(),
+            calib.distortion_coefficients(), projected);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*points.size());
+}
+BENCHMARK(BM_CalibProject_opencv)->RangeMultiplier(10)->Range(10, 1000000)->Unit(benchmark::kMicrosecond);
+
+static void BM_CalibBackProject(benchmark::State& state)
+{
+    std::vector<float> x, y, z, u(state.range(0)), v(state.range(0));
+    court_grid(state.range(0), x, y, z);
+    Calib calib = *inputs().calib;
+    calib.project(x.data(), y.data(), nullptr, x.size(), u.data(), v.data());
+    for (auto _ : state)
+    {
+        calib.back_project(u.data(), v.data(), u.size(), x.data(), y.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations()*u.size());
+}
+BENCHMARK(BM_CalibBackProject)->RangeMultiplier(10)->Range(10, 1000000)->Unit(benchmark::kMicrosecond);
+
+// Export of the court lines of one frame (10 points per line): range(0) is
+// the ExportFormat
+static void BM_LineExporter(benchmark::State& state)
+{
+    ExportFormat format = (ExportFormat)state.range(0);
+    std::string filename = format == csv_export ? "bench_lines.csv" : "bench_lines.bin";
+    {
+        LineExporter export_lines(filename, inputs().court, 10, format);
+        uint32_t frame = 0;
+        for (auto _ : state)
+            export_lines(frame++, *inputs().calib);
+    }
+    std::remove(filename.c_str());
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(format == csv_export ? "csv" : "binary");
+}
+BENCHMARK(BM_LineExporter)->Arg(csv_export)->Arg(binary_export)->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,30 @@
+#include <cstdio>
+#include <stdexcept>
+
+#include "fixtures.hpp"
+
+
+cv::Mat load_raw_image(std::string filename, cv::Size image_size)
+{
+    cv::Mat image(image_size, CV_8UC1);
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if (fp == nullptr)
+    {
+        throw std::runtime_error("could not open '" + filename + "'");
+    }
+    size_t read = std::fread(image.data, image.total(), 1, fp);
+    fclose(fp);
+    if (read != 1)
+    {
+        throw std::runtime_error("could not read " + std::to_string(image.total()) + " bytes from '" + filename + "'");
+    }
+    return image;
+}
+
+
+const cv::Mat& reference_image()
+{
+    static const cv::Mat image = load_raw_image(std::string(ASSETS_DIR) + "/image.raw", cv::Size(1392, 550));
+    return image;
+}
+
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <utils.hpp>
+#include <court.hpp>
+#include <opencv2/opencv.hpp>
+
+
+/**
+ * @brief Loads a raw 8-bit gray image.
+ * @param filename: file containing the raw image bytes
+ * @param image_size: size of the image
+*/
+cv::Mat load_raw_image(std::string filename, cv::Size image_size);
+
+
+/**
+ * @brief Image shipped with the repository (assets/image.raw), loaded once.
+*/
+const cv::Mat& reference_image();
+
@@ -2,10 +2,14 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <iostream>
+#include <sstream>
 #include <cstddef>
 #include <cstdint>
 
 #include <utils.hpp>
+#include <framesource.hpp>
+#include <lineexporter.hpp>
+#include <debugsink.hpp>
 #include <courtdetector.hpp>
 #include <opencv2/opencv.hpp>
 #include <boost/program_options.hpp>
@@ -16,9 +20,18 @@ int main(int argc, char *argv[])
     int nImageSizeX = 1392;
     int nImageSizeY = 550;
     bool debug = false;
+    bool tracking = false;
+    LineTracking line_tracking = profile_tracking;
     std::string filename;
     std::string rule_type = "ITF";
     int steps = 10;
+    std::string export_file = "lines.csv";
+    ExportFormat export_format = csv_export;
+    int pyramid_levels = 0;
+    int threshold = 128;
+    int contrast = 20;
+    std::string debug_output;
+    std::vector<std::string> debug_layers;
 
     try
     {
@@ -27,11 +40,20 @@ int main(int argc, char *argv[])
         desc.add_options()
             ("help,h", "produce help message")
             ("debug", "enable debug mode")
-            ("filename", boost::program_options::value<std::string>(), "Input image filename (REQUIRED): a file containing the raw image bytes.")
+            ("debug-output", boost::program_options::value<std::string>(), "Directory in which the debug layers of each image are written as PNG files, or video file (.avi or .mp4) in which they are drawn. They are rendered in the background, and images are dropped rather than slowing down the detection.")
+            ("debug-layers", boost::program_options::value<std::string>(), "Comma-separated names of the debug layers written to the debug output, e.g. 'identify_lines,refine_calibration' (default: all).")
+            ("tracking", "track the court lines between consecutive images")
+            ("hough-tracking", "track the court lines with a Hough transform restricted to each line (implies --tracking)")
+            ("pyramid-levels", boost::program_options::value<int>(), "Number of times the image is halved before the full detection, lines and calibration being refined at full resolution (default: 0).")
+            ("threshold", boost::program_options::value<int>(), "Minimum gray level of line pixels (default: 128).")
+            ("contrast", boost::program_options::value<int>(), "Minimum difference between line pixels and the pixels on both sides of the line (default: 20).")
+            ("filename", boost::program_options::value<std::string>(), "Input filename (REQUIRED): a file containing the raw bytes of one or more images, one after the other, or '-' to read them from stdin.")
             ("width", boost::program_options::value<int>(), "Input image width (required to decode raw image)")
             ("height", boost::program_options::value<int>(), "Input image height (required to decode raw image)")
-            ("rule-type", boost::program_options::value<std::string>(), "Rule type describing the tennis court (REQUIRED): currently only 'ITF' is supported.")
+            ("rule-type", boost::program_options::value<std::string>(), "Rule type describing the court (REQUIRED): 'ITF' (tennis), 'padel', 'badminton' or 'pickleball'.")
             ("steps", boost::program_options::value<int>(), "Number of steps to use when discretizing the tennis court (default: 10).")
+            ("export-file", boost::program_options::value<std::string>(), "File in which the court lines of each calibrated image are exported (default: lines.csv, or lines.bin in binary).")
+            ("export-format", boost::program_options::value<std::string>(), "Format of the exported lines: 'csv' or 'binary' (default: csv).")
         ;
 
         boost::program_options::variables_map vm;
@@ -44,6 +66,20 @@ int main(int argc, char *argv[])
             return 0;
         }
         debug = vm.count("debug");
+        tracking = vm.count("tracking") || vm.count("hough-tracking");
+        line_tracking = vm.count("hough-tracking") ? hough_tracking : profile_tracking;
+        if (vm.count("pyramid-levels"))
+        {
+            pyramid_levels = vm["pyramid-levels"].as<int>();
+        }
+        if (vm.count("threshold"))
+        {
+            threshold = vm["threshold"].as<int>();
+        }
+        if (vm.count("contrast"))
+        {
+            contrast = vm["contrast"].as<int>();
+        }
 
         if (vm.count("filename"))
         {
@@ -96,6 +132,34 @@ int main(int argc, char *argv[])
             std::cerr << "Warning: no number of steps specified. Using default " << steps << std::endl;
         }
 
+        if (vm.count("export-format"))
+        {
+            std::string format = vm["export-format"].as<std::string>();
+            if (format != "csv" && format != "binary")
+            {
+                std::cerr << "Error: unknown export format '" << format << "'." << std::endl;
+                return 1;
+            }
+            export_format = format == "csv" ? csv_export : binary_export;
+            export_file = format == "csv" ? "lines.csv" : "lines.bin";
+        }
+        if (vm.count("export-file"))
+        {
+            export_file = vm["export-file"].as<std::string>();
+        }
+
+        if (vm.count("debug-output"))
+        {
+            debug_output = vm["debug-output"].as<std::string>();
+        }
+        if (vm.count("debug-layers"))
+        {
+            std::istringstream layers(vm["debug-layers"].as<std::string>());
+            std::string layer;
+            while (std::getline(layers, layer, ','))
+                debug_layers.push_back(layer);
+        }
+
     }
     catch(std::exception& e)
     {
@@ -108,43 +172,101 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    // Load image data
-    cv::Mat image = cv::Mat(nImageSizeY, nImageSizeX, CV_8UC1);
-    FILE *fp = fopen(filename.c_str(), "rb");
-    if (fp)
+    // Open image data and the lines export, and create the court detection
+    // module
+    cv::Size image_size(nImageSizeX, nImageSizeY);
+    std::unique_ptr<FrameSource> source;
+    std::unique_ptr<LineExporter> export_lines;
+    std::unique_ptr<AsyncDebugSink> debug_sink;
+    std::unique_ptr<CourtDetector> courtdetector;
+    try
     {
-        std::fread(image.data, nImageSizeX * nImageSizeY, 1, fp);
-        fclose(fp);
+        Court court(rule_type);
+        source = open_frame_source(filename, image_size);
+        export_lines.reset(new LineExporter(export_file, court, steps, export_format));
+        if (!debug_output.empty())
+        {
+            size_t n = debug_output.size();
+            bool video = n >= 4 && (debug_output.compare(n - 4, 4, ".avi") == 0 || debug_output.compare(n - 4, 4, ".mp4") == 0);
+            debug_sink.reset(new AsyncDebugSink(debug_output, video ? video_output : png_output, debug_layers));
+        }
+        courtdetector.reset(new CourtDetector(court, image_size, debug, tracking, line_tracking, pyramid_levels, threshold, contrast));
+        courtdetector->set_debug_sink(debug_sink.get());
     }
-    else
+    catch(std::exception& e)
     {
-        std::cerr << "Error: could not open '" << filename << "'\n";
+        std::cerr << "Error: " << e.what() << std::endl;
         return 1;
     }
 
-    // Create court detection module
-    Court court(rule_type);
-    CourtDetector courtdetector(court, image.size(), debug);
-
-    // Run court detection with current image
-    Calib calib = courtdetector(image);
-
-    // Traverse lines
-    cv::Mat canvas;
-    cv::Mat *canvas_ptr = debug ? &canvas : nullptr;
-    if (debug) {cv::cvtColor(image, canvas, cv::COLOR_GRAY2RGB);}
-    write_line("netline.csv", calib, court.netline(), steps, &canvas);
-    write_line("baseline.csv", calib, court.baseline(), steps, &canvas);
-    write_line("serveline.csv", calib, court.serveline(), steps, &canvas);
-    write_line("centerline.csv", calib, court.centerline(), steps, &canvas);
-    write_line("left_sideline.csv", calib, court.left_sideline(), steps, &canvas);
-    write_line("right_sideline.csv", calib, court.right_sideline(), steps, &canvas);
-    write_line("left_single_sideline.csv", calib, court.left_single_sideline(), steps, &canvas);
-    write_line("right_single_sideline.csv", calib, court.right_single_sideline(), steps, &canvas);
-    if (debug) {cv::imshow("lines sampled", canvas); cv::waitKey(0);}
-
-    std::cout << "Image projection matrix P:" << std::endl;
-    std::cout << calib.P << std::endl;
+    // Run court detection on each image. Images are read in place from the
+    // input (memory-mapped files) or in a single buffer (streams), and the
+    // calibration is updated in place. Images where the court isn't found are
+    // reported and skipped.
+    cv::Mat image;
+    Calib calib;
+    bool lines_shown = false;
+    cv::Mat last_P;
+    int last_frame = -1;
+    for (int frame = 0; source->read(image); frame++)
+    {
+        try
+        {
+            (*courtdetector)(image, calib);
+        }
+        catch(std::exception& e)
+        {
+            std::cerr << "Image " << frame << ": " << e.what() << std::endl;
+            continue;
+        }
+
+        // Export the court lines of each calibrated image, and show those of
+        // the first one in debug mode
+        DebugLayer layer("lines sampled");
+        DebugLayer *layer_ptr = debug && !lines_shown ? &layer : nullptr;
+        try
+        {
+            (*export_lines)(frame, calib, layer_ptr);
+        }
+        catch(std::exception& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        if (layer_ptr != nullptr)
+        {
+            lines_shown = true;
+            cv::Mat canvas;
+            cv::cvtColor(image, canvas, cv::COLOR_GRAY2RGB);
+            layer.render(canvas);
+            cv::imshow(layer.name(), canvas);
+            cv::waitKey(0);
+        }
 
+        // Printing is slow: the projection matrix of every image is only
+        // printed in debug mode, otherwise that of the last one at the end
+        if (debug)
+            std::cout << "Image " << frame << " projection matrix P:\n" << calib.P << '\n';
+        calib.P.copyTo(last_P);
+        last_frame = frame;
+    }
+    if (last_frame >= 0 && !debug)
+        std::cout << "Image " << last_frame << " projection matrix P:\n" << last_P << '\n';
+
+    try
+    {
+        export_lines->flush();
+        if (debug_sink)
+        {
+            debug_sink->close();
+            std::cout << "Debug images dropped: " << debug_sink->dropped() << "/" << debug_sink->submitted() << std::endl;
+        }
+    }
+    catch(std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    std::cout << export_file << " written" << std::endl;
     return 0;
 }
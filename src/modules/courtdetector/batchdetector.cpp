@@ -0,0 +1,74 @@
+#include <utils.hpp>
+
+#include "batchdetector.hpp"
+
+
+BatchDetector::Stream::Stream(Court court, cv::Size image_size, bool tracking):
+    detector(court, image_size, false, tracking),
+    scheduled(false)
+{}
+
+
+BatchDetector::BatchDetector(int num_threads):
+    pool(num_threads)
+{}
+
+
+int BatchDetector::add_stream(Court court, cv::Size image_size, bool tracking)
+{
+    this->streams.emplace_back(new Stream(court, image_size, tracking));
+    return this->streams.size() - 1;
+}
+
+
+const Metrics& BatchDetector::metrics(int stream_index) const
+{
+    return this->streams.at(stream_index)->detector.metrics();
+}
+
+
+std::future<Calib> BatchDetector::submit(int stream_index, cv::Mat image)
+{
+    Stream& stream = *this->streams.at(stream_index);
+    std::promise<Calib> promise;
+    std::future<Calib> future = promise.get_future();
+
+    std::lock_guard<std::mutex> lock(stream.mutex);
+    stream.images.emplace_back(image, std::move(promise));
+    if (!stream.scheduled)
+    {
+        // At most one task per stream is in the pool, which keeps the
+        // stream's images in order.
+        stream.scheduled = true;
+        this->pool.submit([this, &stream] { this->process(stream); });
+    }
+    return future;
+}
+
+
+void BatchDetector::process(Stream& stream)
+{
+    std::pair<cv::Mat, std::promise<Calib>> item;
+    {
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        item = std::move(stream.images.front());
+        stream.images.pop_front();
+    }
+
+    try
+    {
+        item.second.set_value(stream.detector(item.first));
+    }
+    catch (...)
+    {
+        item.second.set_exception(std::current_exception());
+    }
+
+    // Process the next image of the stream in a new task, letting other
+    // streams interleave.
+    std::lock_guard<std::mutex> lock(stream.mutex);
+    if (stream.images.empty())
+        stream.scheduled = false;
+    else
+        this->pool.submit([this, &stream] { this->process(stream); });
+}
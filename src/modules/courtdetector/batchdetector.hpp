@@ -0,0 +1,63 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <future>
+#include <memory>
+#include <vector>
+#include <utils.hpp>
+#include <threadpool.hpp>
+#include "courtdetector.hpp"
+
+/**
+ * @brief Module detecting tennis courts on several image streams (e.g. one per
+ * camera) concurrently. Each stream owns its CourtDetector, and all streams
+ * share a work-stealing thread pool. Images of a stream are processed one at a
+ * time and in submission order, so that tracking works as with a single
+ * CourtDetector, while different streams are processed in parallel.
+ * @param num_threads Number of worker threads. If 0, the number of hardware
+ * threads is used.
+*/
+class BatchDetector
+{
+    public:
+        BatchDetector(int num_threads=0);
+        /**
+         * @brief Adds a stream. Streams must be added before images are
+         * submitted.
+         * @param court Court object representing the tennis court of the stream
+         * @param image_size Size of the stream images
+         * @param tracking If true, lines are tracked between consecutive images
+         * of the stream (see CourtDetector).
+         * @return the stream index
+        */
+        int add_stream(Court court, cv::Size image_size, bool tracking=true);
+        /**
+         * @brief Schedules the court detection of an image.
+         * @param stream Stream index
+         * @param image Gray image. Its content must not be modified until the
+         * returned future is ready.
+         * @return the calibration of the image. Calibrations of a stream become
+         * ready in submission order. Exceptions raised by the detection are
+         * rethrown by the future.
+        */
+        std::future<Calib> submit(int stream, cv::Mat image);
+        /**
+         * @return the operations latencies and outputs of a stream (see
+         * CourtDetector::metrics). Can be read while images are processed.
+         * @param stream Stream index
+        */
+        const Metrics& metrics(int stream) const;
+    private:
+        struct Stream
+        {
+            Stream(Court court, cv::Size image_size, bool tracking);
+            CourtDetector detector;
+            std::mutex mutex;
+            std::deque<std::pair<cv::Mat, std::promise<Calib>>> images;
+            bool scheduled;
+        };
+        void process(Stream& stream);
+        std::vector<std::unique_ptr<Stream>> streams;
+        ThreadPool pool; // declared last to be joined before streams are destroyed
+};
@@ -1,57 +1,462 @@
+#include <cmath>
+#include <algorithm>
 #include <string>
 #include <iostream>
+#include <stdexcept>
 #include <opencv2/core/mat.hpp>
 
 #include <utils.hpp>
 
 #include "courtdetector.hpp"
 
-CourtDetector::CourtDetector(Court court, cv::Size image_size, bool debug):
+
+// Metric names, built once: most of them are too long for the small string
+// optimization and would be allocated at every record.
+static const std::string downscale_ms = "downscale_ms";
+static const std::string skeletonize_ms = "skeletonize_ms";
+static const std::string remove_small_components_ms = "remove_small_components_ms";
+static const std::string removed_components = "removed_components";
+static const std::string find_segments_ms = "find_segments_ms";
+static const std::string segments_count = "segments";
+static const std::string cluster_segments_ms = "cluster_segments_ms";
+static const std::string clusters_count = "clusters";
+static const std::string refine_lines_ms = "refine_lines_ms";
+static const std::string identify_lines_ms = "identify_lines_ms";
+static const std::string track_lines_ms = "track_lines_ms";
+static const std::string tracking_failures = "tracking_failures";
+static const std::string compute_homography_ms = "compute_homography_ms";
+static const std::string refine_calibration_ms = "refine_calibration_ms";
+static const std::string reprojection_error = "reprojection_error";
+static const std::string total_ms = "total_ms";
+static const std::string validate_ms = "validate_ms";
+static const std::string support = "support";
+static const std::string metrics_write_errors = "metrics_write_errors";
+
+// Debug layer names, built once for the same reason
+static const std::string skeletonize_layer = "skeletonize";
+static const std::string remove_small_components_layer = "remove_small_components";
+static const std::string find_segments_layer = "find_segments";
+static const std::string cluster_segments_layer = "cluster_segments";
+static const std::string refine_lines_layer = "refine_lines";
+static const std::string identify_lines_layer = "identify_lines";
+static const std::string track_lines_layer = "track_lines";
+static const std::string compute_homography_layer = "compute_homography";
+static const std::string refine_calibration_layer = "refine_calibration";
+static const std::string validate_layer = "validate";
+
+/**
+ * Size of the image after `levels` calls to cv::pyrDown
+*/
+static cv::Size pyramid_size(cv::Size image_size, int levels)
+{
+    for (int level = 0; level < levels; level++)
+    {
+        image_size = cv::Size((image_size.width + 1)/2, (image_size.height + 1)/2);
+    }
+    return image_size;
+}
+
+/**
+ * Checks `levels` before the operations parameters are scaled by 2^levels:
+ * it must not be negative and the coarse image must keep at least
+ * `min_side` pixels on its smallest side.
+*/
+static int checked_pyramid_levels(int levels, cv::Size image_size, int min_side=64)
+{
+    if (levels < 0)
+    {
+        throw std::invalid_argument("pyramid levels must not be negative");
+    }
+    for (int level = 0; level < levels; level++)
+    {
+        image_size = cv::Size((image_size.width + 1)/2, (image_size.height + 1)/2);
+        if (std::min(image_size.width, image_size.height) < min_side)
+        {
+            throw std::invalid_argument("too many pyramid levels: the image would be smaller than " + std::to_string(min_side) + " pixels after " + std::to_string(level + 1) + " levels");
+        }
+    }
+    return levels;
+}
+
+
+CourtDetector::CourtDetector(Court court, cv::Size image_size, bool debug, bool tracking, LineTracking line_tracking, int pyramid_levels, int threshold, int contrast):
     debug(debug),
+    tracking(tracking),
+    line_tracking(line_tracking),
+    // Checked first, the other members are derived from it
+    pyramid_levels(checked_pyramid_levels(pyramid_levels, image_size)),
+    detection_size(pyramid_size(image_size, this->pyramid_levels)),
+    pyramid(this->pyramid_levels),
+    court(court),
     image_size(image_size),
-    skeletonize(Skeletonize()),
-    remove_small_components(RemoveSmallComponents(50)),
-    find_segments(FindSegments(1, 1, 10, 100, 100)),
+    has_previous_calib(false),
+    skeletonize(Skeletonize(court, this->detection_size, threshold, contrast)),
+    // Areas and lengths are given at full resolution
+    remove_small_components(RemoveSmallComponents(50 >> (2*this->pyramid_levels))),
+    find_segments(FindSegments(1, 1, 10, 100 >> this->pyramid_levels, 100 >> this->pyramid_levels)),
     cluster_segments(ClusterSegments(50, 5)),
-    identify_lines(IdentifyLines(20)),
-    compute_homography(ComputeHomography(court, image_size))
-{}
+    // Coarse lines are up to a coarse pixel away from the line center
+    refine_lines(RefineLines(4 + (1 << this->pyramid_levels), 5, 32, 0.5)),
+    identify_lines(IdentifyLines(court, 20)),
+    track_lines(TrackLines(court, 10, 50, 0.5, threshold)),
+    search_lines(SearchLines(court, 10, 3, 1, 0.25, 0.5, threshold)),
+    compute_homography(ComputeHomography(court, image_size)),
+    refine_calibration(RefineCalibration(court, image_size, 10, 20, 1.5, 20)),
+    validate_calibration(ValidateCalibration(court, image_size, 3, 50, threshold, contrast)),
+    debug_count(0),
+    debug_sink(nullptr),
+    metrics_format(json_metrics),
+    metrics_period(0)
+{
+    this->roi = cv::Rect(cv::Point(0, 0), this->detection_size);
+}
 
 
-Calib CourtDetector::operator()(cv::Mat& input_image)
+void CourtDetector::reset()
 {
-    cv::Mat canvas;
-    cv::Mat *canvas_ptr = this->debug ? &canvas : nullptr;
+    this->has_previous_calib = false;
+}
+
+
+void CourtDetector::set_roi(std::vector<cv::Point> polygon)
+{
+    // The ROI is kept at the resolution of the full detection
+    int scale = 1 << this->pyramid_levels;
+    for (cv::Point& point : polygon)
+    {
+        point = cv::Point(cvFloor((float)point.x/scale), cvFloor((float)point.y/scale));
+    }
+    this->roi = cv::boundingRect(polygon) & cv::Rect(cv::Point(0, 0), this->detection_size);
+    if (this->roi.empty())
+    {
+        throw std::invalid_argument("region of interest doesn't intersect the image");
+    }
+    for (cv::Point& point : polygon)
+    {
+        point = point - this->roi.tl();
+    }
+    this->roi_mask = cv::Mat::zeros(this->roi.size(), CV_8UC1);
+    cv::fillPoly(this->roi_mask, std::vector<std::vector<cv::Point>>{polygon}, cv::Scalar(255));
+}
+
+
+void CourtDetector::set_roi(Calib calib, int margin)
+{
+    // Sample the court outline and keep the points in front of the camera.
+    // Court points lie on the z=0 plane.
+    const CourtDefinition& definition = this->court.definition();
+    std::vector<cv::Point3f> outline[] = {
+        {cv::Point3f(0, 0, 0), cv::Point3f(0, definition.length, 0)},
+        {cv::Point3f(definition.width, 0, 0), cv::Point3f(definition.width, definition.length, 0)},
+    };
+    std::vector<cv::Point2f> points;
+    const double *P = calib.P.ptr<double>(0);
+    const int steps = 20;
+    for (const std::vector<cv::Point3f>& line : outline)
+    {
+        for (int i = 0; i <= steps; i++)
+        {
+            cv::Point3f p = line[0] + (float)i/steps*(line[1] - line[0]);
+            double z = P[8]*p.x + P[9]*p.y + P[11];
+            if (z <= 0)
+                continue;
+            // Clamp to avoid overflows with points close to the horizon
+            double x = std::min(std::max((P[0]*p.x + P[1]*p.y + P[3])/z, -1.0), (double)this->image_size.width);
+            double y = std::min(std::max((P[4]*p.x + P[5]*p.y + P[7])/z, -1.0), (double)this->image_size.height);
+            points.push_back(cv::Point2f(x, y));
+        }
+    }
+    if (points.empty())
+    {
+        throw std::invalid_argument("court is not visible with the given calibration");
+    }
+
+    // Convex hull enlarged by the margin
+    std::vector<cv::Point2f> hull;
+    cv::convexHull(points, hull);
+    cv::Point2f center(0, 0);
+    for (cv::Point2f point : hull)
+        center += point;
+    center = center/(float)hull.size();
+    std::vector<cv::Point> polygon;
+    for (cv::Point2f point : hull)
+    {
+        cv::Point2f direction = point - center;
+        float norm = cv::norm(direction);
+        polygon.push_back(norm > 0 ? point + (margin/norm)*direction : point);
+    }
+    this->set_roi(polygon);
+}
+
+
+void CourtDetector::clear_roi()
+{
+    this->roi = cv::Rect(cv::Point(0, 0), this->detection_size);
+    this->roi_mask.release();
+}
+
+
+const Metrics& CourtDetector::metrics() const
+{
+    return this->stage_metrics;
+}
+
+
+const std::string& CourtDetector::metrics_error() const
+{
+    return this->metrics_last_error;
+}
+
+
+void CourtDetector::set_metrics_file(std::string path, MetricsFormat format, double period)
+{
+    this->metrics_path = path;
+    this->metrics_format = format;
+    this->metrics_period = period;
+    this->metrics_written = std::chrono::steady_clock::now();
+}
+
+
+void CourtDetector::detect_lines(cv::Mat& input_image, std::vector<LineSegment>& lines, std::vector<LineSegment>& labeled_lines)
+{
+    std::chrono::steady_clock::time_point start;
+
+    // downscale
+    cv::Mat image = input_image;
+    if (this->pyramid_levels > 0)
+    {
+        start = std::chrono::steady_clock::now();
+        for (cv::Mat& level : this->pyramid)
+        {
+            cv::pyrDown(image, level);
+            image = level;
+        }
+        this->stage_metrics.record(downscale_ms, elapsed_ms(start));
+    }
+    cv::Mat roi_image = image(this->roi);
+    // The first operations draw in the ROI of the pyramid level
+    cv::Point2f roi_offset = this->roi.tl();
+    float scale = (float)(1 << this->pyramid_levels);
 
     // skeletonize
-    if (this->debug) {cv::cvtColor(input_image, canvas, cv::COLOR_GRAY2RGB);}
-    cv::Mat skeletonized = this->skeletonize(input_image, canvas_ptr);
-    if (this->debug) {cv::imshow("after skeletonized", canvas); cv::waitKey();}
+    start = std::chrono::steady_clock::now();
+    this->skeletonize(roi_image, this->skeleton, this->debug_layer(skeletonize_layer, roi_offset, scale));
+    if (!this->roi_mask.empty()) {this->skeleton &= this->roi_mask;}
+    this->stage_metrics.record(skeletonize_ms, elapsed_ms(start));
 
     // remove small connected components
-    if (this->debug) {cv::cvtColor(input_image, canvas, cv::COLOR_GRAY2RGB);}
-    cv::Mat cleaned = this->remove_small_components(skeletonized, canvas_ptr);
-    if (this->debug) {cv::imshow("after removing small components", canvas); cv::waitKey();}
+    start = std::chrono::steady_clock::now();
+    this->remove_small_components(this->skeleton, this->debug_layer(remove_small_components_layer, roi_offset, scale));
+    this->stage_metrics.record(remove_small_components_ms, elapsed_ms(start));
+    this->stage_metrics.record(removed_components, this->remove_small_components.removed_components());
 
-    // find segments
-    if (this->debug) {cv::cvtColor(input_image, canvas, cv::COLOR_GRAY2RGB);}
-    std::vector<LineSegment> segments = this->find_segments(cleaned, canvas_ptr);
-    if (this->debug) {cv::imshow("after segments detection", canvas); cv::waitKey();}
+    // find segments, mapped back to full image coordinates (pyrDown centers
+    // the pixels of a level on the even pixels of the previous level)
+    start = std::chrono::steady_clock::now();
+    this->find_segments(this->skeleton, this->segments, this->debug_layer(find_segments_layer, roi_offset, scale));
+    for (LineSegment& segment : this->segments)
+    {
+        segment = LineSegment((segment.x1 + this->roi.x)*scale, (segment.y1 + this->roi.y)*scale,
+                              (segment.x2 + this->roi.x)*scale, (segment.y2 + this->roi.y)*scale);
+    }
+    this->stage_metrics.record(find_segments_ms, elapsed_ms(start));
+    this->stage_metrics.record(segments_count, this->segments.size());
 
     // Cluster segments
-    if (this->debug) {cv::cvtColor(input_image, canvas, cv::COLOR_GRAY2RGB);}
-    std::vector<LineSegment> lines = this->cluster_segments(segments, canvas_ptr);
-    if (this->debug) {cv::imshow("after segments clustering", canvas); cv::waitKey();}
+    start = std::chrono::steady_clock::now();
+    this->cluster_segments(this->segments, lines, this->debug_layer(cluster_segments_layer));
+    this->stage_metrics.record(cluster_segments_ms, elapsed_ms(start));
+    this->stage_metrics.record(clusters_count, lines.size());
+
+    // Refine lines on the gray image
+    start = std::chrono::steady_clock::now();
+    this->refine_lines(input_image, lines, this->debug_layer(refine_lines_layer));
+    this->stage_metrics.record(refine_lines_ms, elapsed_ms(start));
 
     // Identify lines
-    if (this->debug) {cv::cvtColor(input_image, canvas, cv::COLOR_GRAY2RGB);}
-    std::vector<LineSegment> labeled_lines = this->identify_lines(lines, canvas_ptr);
-    if (this->debug) {cv::imshow("after lines identification", canvas); cv::waitKey();}
+    start = std::chrono::steady_clock::now();
+    this->identify_lines(lines, labeled_lines, this->debug_layer(identify_lines_layer));
+    this->stage_metrics.record(identify_lines_ms, elapsed_ms(start));
+}
 
-    // Compute homography
-    if (this->debug) {cv::cvtColor(input_image, canvas, cv::COLOR_GRAY2RGB);}
-    Calib calib = this->compute_homography(labeled_lines, canvas_ptr);
-    if (this->debug) {cv::imshow("after projection", canvas); cv::waitKey();}
 
+Calib CourtDetector::operator()(cv::Mat& input_image)
+{
+    Calib calib;
+    (*this)(input_image, calib);
     return calib;
 }
+
+
+void CourtDetector::operator()(cv::Mat& input_image, Calib& calib)
+{
+    try
+    {
+        this->calibrate(input_image, calib);
+    }
+    catch (...)
+    {
+        // The layers recorded until the failure are the most useful ones
+        this->submit_debug_layers(input_image);
+        throw;
+    }
+    this->submit_debug_layers(input_image);
+}
+
+
+void CourtDetector::calibrate(cv::Mat& input_image, Calib& calib)
+{
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now(), start;
+
+    // Track lines from the previous calibration
+    this->labeled_lines.clear();
+    if (this->tracking && this->has_previous_calib)
+    {
+        start = std::chrono::steady_clock::now();
+        DebugLayer *layer = this->debug_layer(track_lines_layer);
+        if (this->line_tracking == hough_tracking)
+            this->search_lines(input_image, this->previous_calib, this->labeled_lines, layer);
+        else
+            this->track_lines(input_image, this->previous_calib, this->labeled_lines, layer);
+        this->lines = this->labeled_lines;
+        this->stage_metrics.record(track_lines_ms, elapsed_ms(start));
+        this->stage_metrics.record(tracking_failures, this->labeled_lines.empty());
+    }
+
+    // Full detection on the first image or when tracking failed
+    if (this->labeled_lines.empty())
+    {
+        this->detect_lines(input_image, this->lines, this->labeled_lines);
+    }
+
+    // Compute homography
+    start = std::chrono::steady_clock::now();
+    this->compute_homography(this->labeled_lines, calib, this->debug_layer(compute_homography_layer));
+    this->stage_metrics.record(compute_homography_ms, elapsed_ms(start));
+
+    // Refine calibration with all lines
+    start = std::chrono::steady_clock::now();
+    this->refine_calibration(this->lines, calib, this->debug_layer(refine_calibration_layer));
+    this->stage_metrics.record(refine_calibration_ms, elapsed_ms(start));
+    double error = this->refine_calibration.reprojection_error();
+    if (!std::isnan(error)) {this->stage_metrics.record(reprojection_error, error);}
+
+    if (this->tracking)
+    {
+        calib.copyTo(this->previous_calib);
+        this->has_previous_calib = true;
+    }
+
+    this->stage_metrics.record(total_ms, elapsed_ms(begin));
+    if (!this->metrics_path.empty() && elapsed_ms(this->metrics_written) >= 1000*this->metrics_period)
+    {
+        // The calibration is valid whether or not its metrics could be written
+        try
+        {
+            this->stage_metrics.write(this->metrics_path, this->metrics_format, "courtdetector");
+        }
+        catch (std::exception& e)
+        {
+            this->stage_metrics.record(metrics_write_errors, 1);
+            this->metrics_last_error = e.what();
+        }
+        this->metrics_written = std::chrono::steady_clock::now();
+    }
+}
+
+
+Detection CourtDetector::detect(cv::Mat& input_image)
+{
+    Detection detection;
+    this->detect(input_image, detection);
+    return detection;
+}
+
+
+void CourtDetector::detect(cv::Mat& input_image, Detection& detection)
+{
+    try
+    {
+        this->calibrate(input_image, detection.calib);
+        this->check(detection.calib, input_image, detection.quality);
+    }
+    catch (...)
+    {
+        this->submit_debug_layers(input_image);
+        throw;
+    }
+    this->submit_debug_layers(input_image);
+    detection.quality.reprojection_error = this->refine_calibration.reprojection_error();
+}
+
+
+CalibQuality CourtDetector::validate(const Calib& calib, cv::Mat& input_image)
+{
+    CalibQuality quality;
+    this->validate(calib, input_image, quality);
+    return quality;
+}
+
+
+void CourtDetector::validate(const Calib& calib, cv::Mat& input_image, CalibQuality& quality)
+{
+    try
+    {
+        this->check(calib, input_image, quality);
+    }
+    catch (...)
+    {
+        this->submit_debug_layers(input_image);
+        throw;
+    }
+    this->submit_debug_layers(input_image);
+}
+
+
+void CourtDetector::check(const Calib& calib, cv::Mat& input_image, CalibQuality& quality)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    this->validate_calibration(input_image, calib, quality, this->debug_layer(validate_layer));
+    quality.reprojection_error = NAN;
+    this->stage_metrics.record(validate_ms, elapsed_ms(start));
+    if (!std::isnan(quality.support)) {this->stage_metrics.record(support, quality.support);}
+}
+
+
+void CourtDetector::set_debug_sink(AsyncDebugSink *sink)
+{
+    this->debug_sink = sink;
+}
+
+
+DebugLayer* CourtDetector::debug_layer(const std::string& name, cv::Point2f offset, float scale)
+{
+    if (!this->debug && this->debug_sink == nullptr)
+        return nullptr;
+    if (this->debug_count == this->debug_layers.size())
+        this->debug_layers.push_back(DebugLayer());
+    DebugLayer& layer = this->debug_layers[this->debug_count++];
+    layer.reset(name, offset, scale);
+    return &layer;
+}
+
+
+void CourtDetector::submit_debug_layers(const cv::Mat& input_image)
+{
+    size_t count = this->debug_count;
+    this->debug_count = 0;
+    if (this->debug_sink != nullptr)
+    {
+        this->debug_sink->submit(input_image, this->debug_layers, count);
+        return;
+    }
+    // Interactive debug mode: each layer is shown until a key is pressed
+    cv::Mat canvas;
+    for (size_t i = 0; i < count; i++)
+    {
+        cv::cvtColor(input_image, canvas, cv::COLOR_GRAY2RGB);
+        this->debug_layers[i].render(canvas);
+        cv::imshow(this->debug_layers[i].name(), canvas);
+        cv::waitKey();
+    }
+}
@@ -1,28 +1,200 @@
 #pragma once
 
+#include <chrono>
 #include <utils.hpp>
+#include <metrics.hpp>
+#include <debuglayer.hpp>
+#include <debugsink.hpp>
 #include <opencv2/opencv.hpp>
 #include "operations.hpp"
 
+enum LineTracking { profile_tracking, hough_tracking };
+
+/**
+ * @brief Result of a detection
+ * @param calib: calibration of the image
+ * @param quality: quality of the calibration (see CalibQuality)
+*/
+typedef struct {
+    Calib calib;
+    CalibQuality quality;
+} Detection;
+
 /**
  * @brief Module responsible to detect tennis court in the given input image
  * with a series of operations. The operator() returns a Calib object that
  * correspond to input image calibration.
  * @param court Court object representing the current tenis cour to detect.
  * @param image_size Size of the input image
- * @param debug If true, the module will show intermediate results.
+ * @param debug If true, the module shows intermediate results: the operations
+ * record their visualization in debug layers (see DebugLayer), shown one
+ * after the other once the image is processed, waiting for a key press. See
+ * set_debug_sink to render them in the background instead.
+ * @param tracking If true, the module processes consecutive images of a video:
+ * the lines are tracked from the previous image calibration, and the full
+ * detection only runs on the first image or when tracking fails.
+ * @param line_tracking How lines are searched around their projection with
+ * the previous calibration: `profile_tracking` locates the line center on
+ * intensity profiles across the line (see TrackLines), `hough_tracking` votes
+ * in a narrow Hough window around each line (see SearchLines).
+ * @param pyramid_levels Number of times the image is halved (see cv::pyrDown)
+ * before the full detection: skeletonization, connected components and
+ * segments detection run on the coarse image, then the lines are clustered,
+ * refined on the gray image (see RefineLines) and used to compute the
+ * calibration at full resolution. 0 detects at full resolution. The coarse
+ * image must keep at least 64 pixels on its smallest side, otherwise
+ * std::invalid_argument is thrown (as for negative values).
+ * @param threshold Minimum gray level of line pixels, used to binarize the
+ * image and to track and validate the lines.
+ * @param contrast Minimum difference between line pixels and the pixels on
+ * both sides of the line (see Skeletonize and ValidateCalibration).
+ *
+ * The full detection can be restricted to a region of interest (see set_roi):
+ * skeletonization, connected components and segments detection then only
+ * process the ROI bounding box and ignore pixels outside the ROI polygon.
+ * Detected segments are mapped back to full image coordinates.
+ *
+ * Each call records the time spent in every operation ("<operation>_ms") and
+ * the quantities they produce (number of segments, clusters, removed
+ * components and the calibration reprojection error) in histograms exposed by
+ * metrics(), optionally dumped to a file (see set_metrics_file).
+ *
+ * Intermediate images and vectors are kept between calls: once the buffers
+ * have grown to the size needed by the video, calling operator() with an
+ * existing Calib doesn't allocate memory (except in debug mode and when
+ * metrics are written).
 */
 class CourtDetector {
     public:
-        CourtDetector(Court court, cv::Size image_size, bool debug=false);
+        CourtDetector(Court court, cv::Size image_size, bool debug=false, bool tracking=false, LineTracking line_tracking=profile_tracking, int pyramid_levels=0, int threshold=128, int contrast=20);
         Calib operator()(cv::Mat& input_image);
+        /**
+         * @brief Detects the court in an existing calibration object, whose
+         * matrices are overwritten in place (see Calib::update).
+        */
+        void operator()(cv::Mat& input_image, Calib& calib);
+        /**
+         * @brief Detects the court and measures the quality of the resulting
+         * calibration: the reprojection error of the detected lines and the
+         * support of the projected court lines in the image (see validate).
+        */
+        Detection detect(cv::Mat& input_image);
+        /**
+         * @brief Detects the court in an existing result object, whose
+         * calibration is overwritten in place and whose vectors capacity is
+         * reused.
+        */
+        void detect(cv::Mat& input_image, Detection& detection);
+        /**
+         * @brief Checks that a calibration still fits an image by sampling a
+         * few hundred pixels along the projected court lines (see
+         * ValidateCalibration), which is much cheaper than a detection. E.g.
+         * a detection is only needed when the support drops.
+         * @return the support of the calibration (the reprojection error is
+         * NaN).
+        */
+        CalibQuality validate(const Calib& calib, cv::Mat& input_image);
+        /**
+         * @brief Validates in an existing object, whose vectors capacity is
+         * reused.
+        */
+        void validate(const Calib& calib, cv::Mat& input_image, CalibQuality& quality);
+        /**
+         * @brief Forgets the previous image calibration, forcing a full
+         * detection on the next image (e.g. after a scene cut).
+        */
+        void reset();
+        /**
+         * @brief Restricts the full detection to a polygon.
+         * @param polygon ROI polygon in image coordinates
+        */
+        void set_roi(std::vector<cv::Point> polygon);
+        /**
+         * @brief Restricts the full detection to the area where the court is
+         * expected given a prior calibration: the convex hull of the projected
+         * court, enlarged by `margin` pixels.
+         * @param calib Prior calibration
+         * @param margin Margin around the projected court (in pixels)
+        */
+        void set_roi(Calib calib, int margin);
+        /**
+         * @brief Removes the region of interest: the full detection processes
+         * the whole image.
+        */
+        void clear_roi();
+        /**
+         * @return the histograms of operations latencies and outputs.
+        */
+        const Metrics& metrics() const;
+        /**
+         * @brief Periodically writes the metrics to a file, after the image
+         * processed when `period` seconds have elapsed since the last write.
+         * @param path Output file. If empty, metrics are not written anymore.
+         * @param format JSON or Prometheus text format
+         * @param period Time between writes (in seconds)
+        */
+        void set_metrics_file(std::string path, MetricsFormat format=json_metrics, double period=10);
+        /**
+         * @brief A failed metrics write doesn't fail the calibration: it is
+         * counted in the `metrics_write_errors` histogram and its error is kept.
+         * @return the error of the last failed metrics write, empty if none.
+        */
+        const std::string& metrics_error() const;
+        /**
+         * @brief Records the debug layers of each image and submits them to
+         * `sink`, which renders them in its own thread (or drops them when it
+         * is behind): the debug mode then doesn't block and can stay enabled
+         * on a live stream. The layers of an image are submitted once it is
+         * processed, including when an operation fails.
+         * @param sink Debug sink, not owned. If null, the layers are only
+         * recorded and shown in debug mode.
+        */
+        void set_debug_sink(AsyncDebugSink *sink);
     private:
+        void calibrate(cv::Mat& input_image, Calib& calib);
+        void check(const Calib& calib, cv::Mat& input_image, CalibQuality& quality);
+        void detect_lines(cv::Mat& input_image, std::vector<LineSegment>& lines, std::vector<LineSegment>& labeled_lines);
+        /**
+         * @return the next debug layer of the image, reset with `name` and the
+         * transform of the operation coordinates (see DebugLayer::reset), or
+         * null if the layers aren't recorded.
+        */
+        DebugLayer* debug_layer(const std::string& name, cv::Point2f offset=cv::Point2f(0, 0), float scale=1);
+        void submit_debug_layers(const cv::Mat& input_image);
+        Court court;
         cv::Size image_size;
+        cv::Rect roi;
+        cv::Mat roi_mask;
         bool debug;
+        bool tracking;
+        LineTracking line_tracking;
+        int pyramid_levels;
+        cv::Size detection_size;
+        std::vector<cv::Mat> pyramid;
+        Calib previous_calib;
+        bool has_previous_calib;
+        cv::Mat skeleton;
+        std::vector<LineSegment> segments;
+        std::vector<LineSegment> lines;
+        std::vector<LineSegment> labeled_lines;
         Skeletonize skeletonize;
         RemoveSmallComponents remove_small_components;
         FindSegments find_segments;
         ClusterSegments cluster_segments;
+        RefineLines refine_lines;
         IdentifyLines identify_lines;
+        TrackLines track_lines;
+        SearchLines search_lines;
         ComputeHomography compute_homography;
+        RefineCalibration refine_calibration;
+        ValidateCalibration validate_calibration;
+        std::vector<DebugLayer> debug_layers;
+        size_t debug_count;
+        AsyncDebugSink *debug_sink;
+        Metrics stage_metrics;
+        std::string metrics_path;
+        MetricsFormat metrics_format;
+        double metrics_period;
+        std::string metrics_last_error;
+        std::chrono::steady_clock::time_point metrics_written;
 };
@@ -0,0 +1,427 @@
+#include <cmath>
+#include <Eigen/Dense>
+#include <opencv2/calib3d.hpp>
+
+#include <utils.hpp>
+#include "homography.hpp"
+
+
+/**
+ * Cross product matrix: cross_matrix(a)*b = a x b
+*/
+static Eigen::Matrix3d cross_matrix(const Eigen::Vector3d& a)
+{
+    Eigen::Matrix3d A;
+    A << 0, -a(2), a(1),
+         a(2), 0, -a(0),
+         -a(1), a(0), 0;
+    return A;
+}
+
+
+/**
+ * Similarity moving the centroid of the given points to the origin and scaling
+ * them to a mean distance of sqrt(2) to the origin (Hartley normalization).
+*/
+template<typename Point>
+static Eigen::Matrix3d normalization(const std::vector<Point>& points)
+{
+    double cx = 0, cy = 0, distance = 0;
+    for (const Point& point : points)
+    {
+        cx += point.x;
+        cy += point.y;
+    }
+    cx /= points.size();
+    cy /= points.size();
+    for (const Point& point : points)
+    {
+        distance += std::hypot(point.x - cx, point.y - cy);
+    }
+    double scale = std::sqrt(2.0)*points.size()/distance;
+    Eigen::Matrix3d T;
+    T << scale, 0, -scale*cx,
+         0, scale, -scale*cy,
+         0, 0, 1;
+    return T;
+}
+
+
+Eigen::Matrix3d find_homography(const std::vector<cv::Point3f>& world_points, const std::vector<cv::Point2f>& image_points)
+{
+    Eigen::Matrix3d Tw = normalization(world_points);
+    Eigen::Matrix3d Ti = normalization(image_points);
+
+    // Accumulate the normal matrix of the DLT system A h = 0, whose solution is
+    // its eigenvector with the smallest eigenvalue.
+    Eigen::Matrix<double, 9, 9> M = Eigen::Matrix<double, 9, 9>::Zero();
+    Eigen::Matrix<double, 9, 1> a;
+    for (size_t i = 0; i < world_points.size(); i++)
+    {
+        Eigen::Vector3d X = Tw*Eigen::Vector3d(world_points[i].x, world_points[i].y, 1);
+        Eigen::Vector3d x = Ti*Eigen::Vector3d(image_points[i].x, image_points[i].y, 1);
+        a << X(0), X(1), 1, 0, 0, 0, -x(0)*X(0), -x(0)*X(1), -x(0);
+        M.noalias() += a*a.transpose();
+        a << 0, 0, 0, X(0), X(1), 1, -x(1)*X(0), -x(1)*X(1), -x(1);
+        M.noalias() += a*a.transpose();
+    }
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, 9, 9>> solver(M);
+    Eigen::Matrix<double, 9, 1> h = solver.eigenvectors().col(0);
+    Eigen::Matrix3d Hn;
+    Hn << h(0), h(1), h(2),
+          h(3), h(4), h(5),
+          h(6), h(7), h(8);
+
+    Eigen::Matrix3d H = Ti.inverse()*Hn*Tw;
+    return H/H.norm();
+}
+
+
+bool decompose_homography(const Eigen::Matrix3d& H, cv::Size image_size, CameraPose& pose)
+{
+    // Move the principal point to the origin so that K = diag(f, f, 1)
+    pose.cx = (image_size.width - 1)*0.5;
+    pose.cy = (image_size.height - 1)*0.5;
+    Eigen::Matrix3d C;
+    C << 1, 0, -pose.cx,
+         0, 1, -pose.cy,
+         0, 0, 1;
+    Eigen::Matrix3d G = C*H;
+    Eigen::Vector3d h1 = G.col(0), h2 = G.col(1), h3 = G.col(2);
+
+    // With r1 ~ K^-1 h1 and r2 ~ K^-1 h2, the constraints r1.r2 = 0 and
+    // |r1| = |r2| are both linear in 1/f^2: solve them in the least squares
+    // sense.
+    double a1 = h1(0)*h2(0) + h1(1)*h2(1);
+    double b1 = h1(2)*h2(2);
+    double a2 = h1(0)*h1(0) + h1(1)*h1(1) - h2(0)*h2(0) - h2(1)*h2(1);
+    double b2 = h1(2)*h1(2) - h2(2)*h2(2);
+    double denominator = a1*a1 + a2*a2;
+    double inverse_focal2 = denominator > 0 ? -(a1*b1 + a2*b2)/denominator : 0;
+    if (!(inverse_focal2 > 0))
+        return false;
+    pose.focal = 1/std::sqrt(inverse_focal2);
+
+    // Pose up to scale, with the court in front of the camera
+    Eigen::Vector3d Kinv(1/pose.focal, 1/pose.focal, 1);
+    Eigen::Vector3d r1 = Kinv.cwiseProduct(h1);
+    Eigen::Vector3d r2 = Kinv.cwiseProduct(h2);
+    Eigen::Vector3d t  = Kinv.cwiseProduct(h3);
+    double lambda = 2/(r1.norm() + r2.norm());
+    lambda = t(2) < 0 ? -lambda : lambda;
+    r1 *= lambda;
+    r2 *= lambda;
+
+    // Closest rotation matrix
+    Eigen::Matrix3d R;
+    R << r1, r2, r1.cross(r2);
+    Eigen::JacobiSVD<Eigen::Matrix3d> svd(R, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    pose.R = svd.matrixU()*svd.matrixV().transpose();
+    pose.t = lambda*t;
+    return pose.R.determinant() > 0;
+}
+
+
+bool calib_pose(const Calib& calib, CameraPose& pose)
+{
+    const cv::Mat& distortion = calib.distortion_coefficients();
+    if (!distortion.empty() && cv::norm(distortion, cv::NORM_INF) > 0)
+        return false;
+    cv::Mat_<double> K = calib.camera_matrix();
+    if (K(0, 1) != 0 || K(1, 0) != 0 || std::abs(K(0, 0) - K(1, 1)) > 1e-9*std::abs(K(0, 0)))
+        return false;
+    pose.focal = K(0, 0);
+    pose.cx = K(0, 2);
+    pose.cy = K(1, 2);
+
+    // Rotation matrix in a stack buffer, as in Calib
+    double r[9];
+    cv::Mat R(3, 3, CV_64F, r);
+    cv::Rodrigues(calib.rotation_vector(), R);
+    cv::Mat_<double> t = calib.translation_vector();
+    pose.R << r[0], r[1], r[2],
+              r[3], r[4], r[5],
+              r[6], r[7], r[8];
+    pose.t << t(0), t(1), t(2);
+    return true;
+}
+
+
+void refine_pose(const std::vector<cv::Point3f>& world_points, const std::vector<cv::Point2f>& image_points, CameraPose& pose, int iterations)
+{
+    const double cx = pose.cx, cy = pose.cy;
+    auto cost = [&](const CameraPose& pose) {
+        double cost = 0;
+        for (size_t i = 0; i < world_points.size(); i++)
+        {
+            Eigen::Vector3d Xc = pose.R*Eigen::Vector3d(world_points[i].x, world_points[i].y, world_points[i].z) + pose.t;
+            cost += std::pow(pose.focal*Xc(0)/Xc(2) + cx - image_points[i].x, 2)
+                  + std::pow(pose.focal*Xc(1)/Xc(2) + cy - image_points[i].y, 2);
+        }
+        return cost;
+    };
+
+    // Parameters: focal length, rotation increment (applied on the left of R)
+    // and translation.
+    double current = cost(pose);
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        Eigen::Matrix<double, 7, 7> JtJ = Eigen::Matrix<double, 7, 7>::Zero();
+        Eigen::Matrix<double, 7, 1> Jtr = Eigen::Matrix<double, 7, 1>::Zero();
+        Eigen::Matrix<double, 2, 7> J;
+        for (size_t i = 0; i < world_points.size(); i++)
+        {
+            Eigen::Vector3d RX = pose.R*Eigen::Vector3d(world_points[i].x, world_points[i].y, world_points[i].z);
+            Eigen::Vector3d Xc = RX + pose.t;
+            double z = Xc(2);
+            Eigen::Vector2d r(pose.focal*Xc(0)/z + cx - image_points[i].x, pose.focal*Xc(1)/z + cy - image_points[i].y);
+
+            Eigen::Matrix<double, 2, 3> dproj; // derivative of the projection w.r.t. Xc
+            dproj << pose.focal/z, 0, -pose.focal*Xc(0)/(z*z),
+                     0, pose.focal/z, -pose.focal*Xc(1)/(z*z);
+            J.col(0) << Xc(0)/z, Xc(1)/z;
+            J.block<2, 3>(0, 1) = -dproj*cross_matrix(RX); // d(RX)/dw = -[RX]x
+            J.block<2, 3>(0, 4) = dproj;
+            JtJ.noalias() += J.transpose()*J;
+            Jtr.noalias() += J.transpose()*r;
+        }
+
+        Eigen::Matrix<double, 7, 1> delta = -JtJ.ldlt().solve(Jtr);
+        CameraPose candidate = pose;
+        candidate.focal += delta(0);
+        Eigen::Vector3d w = delta.segment<3>(1);
+        if (w.norm() > 0)
+            candidate.R = Eigen::AngleAxisd(w.norm(), w.normalized()).toRotationMatrix()*pose.R;
+        candidate.t += delta.segment<3>(4);
+
+        double updated = cost(candidate);
+        if (!(updated < current))
+            break;
+        pose = candidate;
+        current = updated;
+    }
+}
+
+
+int refine_pose_on_lines(const std::vector<std::vector<cv::Point3f>>& world_lines, const std::vector<cv::Point2f>& image_points, const std::vector<cv::Point2f>& image_directions, CameraPose& pose, float max_distance, float loss_scale, int iterations, double *error, LineRefinementWorkspace *workspace)
+{
+    const size_t num_lines = world_lines.size(), num_points = image_points.size();
+    const double cx = pose.cx, cy = pose.cy;
+    const double max_sine = std::sin(10*M_PI/180); // maximum angle between associated lines
+
+    LineRefinementWorkspace local;
+    if (workspace == nullptr)
+        workspace = &local;
+    std::vector<ProjectedLine>& projected = workspace->projected;
+    projected.resize(num_lines);
+    auto project = [&](const CameraPose& pose) {
+        Eigen::Matrix3d K;
+        K << pose.focal, 0, cx,
+             0, pose.focal, cy,
+             0, 0, 1;
+        for (size_t k = 0; k < num_lines; k++)
+        {
+            ProjectedLine& line = projected[k];
+            line.RX1 = pose.R*Eigen::Vector3d(world_lines[k][0].x, world_lines[k][0].y, 0);
+            line.RX2 = pose.R*Eigen::Vector3d(world_lines[k][1].x, world_lines[k][1].y, 0);
+            line.p = K*(line.RX1 + pose.t);
+            line.q = K*(line.RX2 + pose.t);
+            line.l = line.p.cross(line.q);
+            line.norm = line.l.head<2>().norm();
+            line.visible = line.p(2) > 0 && line.q(2) > 0 && line.norm > 0;
+        }
+    };
+    auto distance = [&](size_t i, size_t k) {
+        const ProjectedLine& line = projected[k];
+        return (line.l(0)*image_points[i].x + line.l(1)*image_points[i].y + line.l(2))/line.norm;
+    };
+    auto huber = [&](double r) {
+        double a = std::abs(r);
+        return a <= loss_scale ? 0.5*r*r : loss_scale*(a - 0.5*loss_scale);
+    };
+
+    // Associates each point with the closest visible projected segment and
+    // returns the number of associated points, their loss and their squared
+    // distances.
+    std::vector<int>& association = workspace->association;
+    association.resize(num_points);
+    auto associate = [&](double& loss, double& squares) {
+        int inliers = 0;
+        loss = squares = 0;
+        for (size_t i = 0; i < num_points; i++)
+        {
+            association[i] = -1;
+            double best = max_distance;
+            Eigen::Vector2d x(image_points[i].x, image_points[i].y);
+            for (size_t k = 0; k < num_lines; k++)
+            {
+                const ProjectedLine& line = projected[k];
+                if (!line.visible)
+                    continue;
+                Eigen::Vector2d p = line.p.head<2>()/line.p(2), q = line.q.head<2>()/line.q(2);
+                Eigen::Vector2d u = q - p;
+                double length = u.norm();
+                u /= length;
+                double t = (x - p).dot(u);
+                double sine = std::abs(u(0)*image_directions[i].y - u(1)*image_directions[i].x);
+                double d = std::abs(distance(i, k));
+                if (d < best && t > -max_distance && t < length + max_distance && sine < max_sine)
+                {
+                    best = d;
+                    association[i] = k;
+                }
+            }
+            if (association[i] >= 0)
+            {
+                inliers++;
+                loss += huber(best);
+                squares += best*best;
+            }
+        }
+        return inliers;
+    };
+
+    int inliers = 0;
+    double lambda = 1e-3, squares;
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        double current;
+        project(pose);
+        inliers = associate(current, squares);
+        if (inliers < 7)
+            break;
+
+        // Normal equations of the reweighted least squares problem. Parameters
+        // are the focal length, the rotation increment (applied on the left of
+        // R) and the translation.
+        Eigen::Matrix3d K;
+        K << pose.focal, 0, cx,
+             0, pose.focal, cy,
+             0, 0, 1;
+        Eigen::Matrix<double, 7, 7> JtJ = Eigen::Matrix<double, 7, 7>::Zero();
+        Eigen::Matrix<double, 7, 1> Jtr = Eigen::Matrix<double, 7, 1>::Zero();
+        Eigen::Matrix<double, 3, 7> dp, dq;
+        for (size_t i = 0; i < num_points; i++)
+        {
+            if (association[i] < 0)
+                continue;
+            const ProjectedLine& line = projected[association[i]];
+            double r = distance(i, association[i]);
+            double weight = std::abs(r) <= loss_scale ? 1 : loss_scale/std::abs(r);
+
+            // Derivatives of the projected extremities...
+            Eigen::Vector3d m1 = line.RX1 + pose.t, m2 = line.RX2 + pose.t;
+            dp.col(0) << m1(0), m1(1), 0;
+            dq.col(0) << m2(0), m2(1), 0;
+            dp.block<3, 3>(0, 1) = -K*cross_matrix(line.RX1);
+            dq.block<3, 3>(0, 1) = -K*cross_matrix(line.RX2);
+            dp.block<3, 3>(0, 4) = K;
+            dq.block<3, 3>(0, 4) = K;
+            // ...of the image line l = p x q...
+            Eigen::Matrix<double, 3, 7> dl = cross_matrix(line.p)*dq - cross_matrix(line.q)*dp;
+            // ...and of the point to line distance r = l.x/|l[0:2]|
+            Eigen::RowVector3d dr((image_points[i].x - r*line.l(0)/line.norm)/line.norm,
+                                  (image_points[i].y - r*line.l(1)/line.norm)/line.norm,
+                                  1/line.norm);
+            Eigen::Matrix<double, 1, 7> J = dr*dl;
+            JtJ.noalias() += weight*J.transpose()*J;
+            Jtr.noalias() += weight*r*J.transpose();
+        }
+
+        // Levenberg-Marquardt step, evaluated with the same associations
+        Eigen::Matrix<double, 7, 7> A = JtJ;
+        A.diagonal() *= 1 + lambda;
+        Eigen::Matrix<double, 7, 1> delta = -A.ldlt().solve(Jtr);
+        CameraPose candidate = pose;
+        candidate.focal += delta(0);
+        Eigen::Vector3d w = delta.segment<3>(1);
+        if (w.norm() > 0)
+            candidate.R = Eigen::AngleAxisd(w.norm(), w.normalized()).toRotationMatrix()*pose.R;
+        candidate.t += delta.segment<3>(4);
+
+        project(candidate);
+        double updated = 0;
+        for (size_t i = 0; i < num_points; i++)
+        {
+            if (association[i] >= 0)
+                updated += projected[association[i]].visible ? huber(distance(i, association[i])) : huber(max_distance);
+        }
+        if (updated < current)
+        {
+            pose = candidate;
+            lambda = std::max(lambda/10, 1e-7);
+        }
+        else
+        {
+            lambda *= 10;
+        }
+    }
+    if (error != nullptr)
+    {
+        double loss;
+        project(pose);
+        inliers = associate(loss, squares);
+        *error = inliers > 0 ? std::sqrt(squares/inliers) : NAN;
+    }
+    return inliers;
+}
+
+
+Calib make_calib(const CameraPose& pose, cv::Size image_size)
+{
+    Calib calib;
+    make_calib(pose, image_size, calib);
+    return calib;
+}
+
+
+void make_calib(const CameraPose& pose, cv::Size image_size, Calib& calib)
+{
+    // Parameters are written in stack buffers wrapped by cv::Mat headers
+    double K[9] = {pose.focal, 0, pose.cx,
+                   0, pose.focal, pose.cy,
+                   0, 0, 1};
+    double D[5] = {0, 0, 0, 0, 0};
+    Eigen::AngleAxisd rotation(pose.R);
+    Eigen::Vector3d r = rotation.angle()*rotation.axis();
+    double rv[3] = {r(0), r(1), r(2)};
+    double tv[3] = {pose.t(0), pose.t(1), pose.t(2)};
+    calib.update(cv::Mat(3, 3, CV_64F, K), cv::Mat(1, 5, CV_64F, D), cv::Mat(3, 1, CV_64F, rv), cv::Mat(3, 1, CV_64F, tv), image_size);
+}
+
+
+Calib solve_calibration(const std::vector<cv::Point3f>& world_points, const std::vector<cv::Point2f>& image_points, cv::Size image_size, int iterations)
+{
+    Calib calib;
+    solve_calibration(world_points, image_points, image_size, iterations, calib);
+    return calib;
+}
+
+
+void solve_calibration(const std::vector<cv::Point3f>& world_points, const std::vector<cv::Point2f>& image_points, cv::Size image_size, int iterations, Calib& calib)
+{
+    CameraPose pose;
+    Eigen::Matrix3d H = find_homography(world_points, image_points);
+    if (!decompose_homography(H, image_size, pose))
+    {
+        // The focal length can't be recovered from the homography alone
+        calibrate_camera(world_points, image_points, image_size).copyTo(calib);
+        return;
+    }
+    refine_pose(world_points, image_points, pose, iterations);
+    make_calib(pose, image_size, calib);
+}
+
+
+Calib calibrate_camera(const std::vector<cv::Point3f>& world_points, const std::vector<cv::Point2f>& image_points, cv::Size image_size)
+{
+    std::vector<std::vector<cv::Point3f>> objectPoints = {world_points};
+    std::vector<std::vector<cv::Point2f>> imagePoints = {image_points};
+
+    std::vector<cv::Mat> rvec, tvec;
+    cv::Mat distCoefs = cv::Mat::zeros(1, 5, CV_64F);
+    cv::Mat cameraMatrix = cv::Mat::eye(3, 3, CV_64F);
+    int flags = cv::CALIB_FIX_ASPECT_RATIO | cv::CALIB_ZERO_TANGENT_DIST | cv::CALIB_FIX_K1 | cv::CALIB_FIX_K2 | cv::CALIB_FIX_K3;
+    cv::calibrateCamera(objectPoints, imagePoints, image_size, cameraMatrix, distCoefs, rvec, tvec, flags);
+    return Calib(cameraMatrix, distCoefs, rvec[0], tvec[0], image_size);
+}
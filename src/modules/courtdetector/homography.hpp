@@ -0,0 +1,152 @@
+#pragma once
+
+#include <vector>
+#include <Eigen/Dense>
+#include <utils.hpp>
+
+
+/**
+ * @brief Camera with square pixels, no skew and no lens distortion.
+ * @param focal: focal length (in pixels)
+ * @param cx, cy: principal point (in pixels), fixed by the refinements
+ * @param R: rotation from the world coordinate system to the camera coordinate
+ * system
+ * @param t: translation expressed in the camera coordinate system
+*/
+typedef struct {
+    double focal;
+    double cx, cy;
+    Eigen::Matrix3d R;
+    Eigen::Vector3d t;
+} CameraPose;
+
+
+/**
+ * @brief Estimates the homography mapping the z=0 world plane to the image
+ * with the normalized Direct Linear Transform.
+ * @param world_points: points on the z=0 plane (at least 4)
+ * @param image_points: corresponding image points
+ * @return 3x3 homography matrix
+*/
+Eigen::Matrix3d find_homography(const std::vector<cv::Point3f>& world_points, const std::vector<cv::Point2f>& image_points);
+
+
+/**
+ * @brief Recovers the camera focal length and pose from the homography of the
+ * z=0 world plane in closed form, using the orthonormality of the first two
+ * rotation columns. The principal point is assumed at the image center.
+ * @param H: homography mapping the z=0 world plane to the image
+ * @param image_size: size of the image
+ * @param pose: recovered camera
+ * @return false if the homography is degenerate (e.g. fronto-parallel view)
+*/
+bool decompose_homography(const Eigen::Matrix3d& H, cv::Size image_size, CameraPose& pose);
+
+
+/**
+ * @brief Reads the camera of a calibration, e.g. to refine it.
+ * @param calib: calibration
+ * @param pose: camera of the calibration
+ * @return false if the calibration has lens distortion, skew or non square
+ * pixels, which CameraPose can't represent.
+*/
+bool calib_pose(const Calib& calib, CameraPose& pose);
+
+
+/**
+ * @brief Refines a camera by minimizing the reprojection error with
+ * Gauss-Newton iterations on the focal length, rotation and translation.
+ * @param world_points: 3D world points
+ * @param image_points: corresponding image points
+ * @param pose: camera to refine
+ * @param iterations: maximum number of iterations
+*/
+void refine_pose(const std::vector<cv::Point3f>& world_points, const std::vector<cv::Point2f>& image_points, CameraPose& pose, int iterations);
+
+
+/**
+ * @brief Projection of a world line by the camera being refined in
+ * refine_pose_on_lines: homogeneous image extremities p and q, image line
+ * l = p x q and its normalization factor.
+*/
+typedef struct {
+    Eigen::Vector3d RX1, RX2, p, q, l;
+    double norm;
+    bool visible;
+} ProjectedLine;
+
+
+/**
+ * @brief Buffers of refine_pose_on_lines, kept by the caller between calls to
+ * avoid reallocating them.
+*/
+typedef struct {
+    std::vector<ProjectedLine> projected;
+    std::vector<int> association;
+} LineRefinementWorkspace;
+
+
+/**
+ * @brief Refines a camera by minimizing the distances between image points
+ * and the projections of the world lines they belong to. At each iteration,
+ * every image point is associated with the closest projected line segment
+ * (within `max_distance` pixels and with a similar direction), then a
+ * Levenberg-Marquardt step is taken on the Huber loss of the point-to-line
+ * distances. The Jacobian is analytic and the normal equations are accumulated
+ * point by point.
+ * @param world_lines: pairs of points on the z=0 plane defining world lines
+ * @param image_points: image points sampled along detected lines
+ * @param image_directions: unit direction of the detected line each image
+ * point was sampled from
+ * @param pose: camera to refine
+ * @param max_distance: maximum distance (in pixels) between an image point and
+ * the projected line it's associated with
+ * @param loss_scale: distance (in pixels) above which the Huber loss becomes
+ * linear
+ * @param iterations: maximum number of iterations
+ * @param error: if not null, set to the root mean square distance (in pixels)
+ * between the associated image points and projected lines with the refined
+ * camera.
+ * @param workspace: if not null, buffers reused instead of allocating them.
+ * @return the number of image points associated with a world line
+*/
+int refine_pose_on_lines(const std::vector<std::vector<cv::Point3f>>& world_lines, const std::vector<cv::Point2f>& image_points, const std::vector<cv::Point2f>& image_directions, CameraPose& pose, float max_distance, float loss_scale, int iterations, double *error=nullptr, LineRefinementWorkspace *workspace=nullptr);
+
+
+/**
+ * @brief Builds the calibration object of a camera.
+*/
+Calib make_calib(const CameraPose& pose, cv::Size image_size);
+
+/**
+ * @brief Writes the parameters of a camera in an existing calibration object,
+ * without allocating (see Calib::update).
+*/
+void make_calib(const CameraPose& pose, cv::Size image_size, Calib& calib);
+
+
+/**
+ * @brief Calibrates the camera from correspondences between points of the z=0
+ * world plane and image points: the homography is estimated with a DLT,
+ * decomposed in closed form and optionally refined.
+ * @param world_points: points on the z=0 plane (at least 4)
+ * @param image_points: corresponding image points
+ * @param image_size: size of the image
+ * @param iterations: number of Gauss-Newton refinement iterations
+ * @return the calibration parameters
+*/
+Calib solve_calibration(const std::vector<cv::Point3f>& world_points, const std::vector<cv::Point2f>& image_points, cv::Size image_size, int iterations);
+
+/**
+ * @brief Same as above, writing the calibration parameters in `calib` (see
+ * Calib::update). Only the `cv::calibrateCamera` fallback allocates.
+*/
+void solve_calibration(const std::vector<cv::Point3f>& world_points, const std::vector<cv::Point2f>& image_points, cv::Size image_size, int iterations, Calib& calib);
+
+
+/**
+ * @brief Calibrates the camera from the same correspondences with
+ * `cv::calibrateCamera`, which also estimates the principal point but is much
+ * slower.
+*/
+Calib calibrate_camera(const std::vector<cv::Point3f>& world_points, const std::vector<cv::Point2f>& image_points, cv::Size image_size);
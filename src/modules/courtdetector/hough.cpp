@@ -0,0 +1,204 @@
+// HoughSegments is adapted from HoughLinesProbabilistic in OpenCV
+// (modules/imgproc/src/hough.cpp), distributed under the following license.
+//
+/*M///////////////////////////////////////////////////////////////////////////////////////
+//
+//  IMPORTANT: READ BEFORE DOWNLOADING, COPYING, INSTALLING OR USING.
+//
+//  By downloading, copying, installing or using the software you agree to this license.
+//  If you do not agree to this license, do not download, install,
+//  copy or use the software.
+//
+//
+//                        Intel License Agreement
+//                For Open Source Computer Vision Library
+//
+// Copyright (C) 2000, Intel Corporation, all rights reserved.
+// Copyright (C) 2014, Itseez, Inc, all rights reserved.
+// Third party copyrights are property of their respective owners.
+//
+// Redistribution and use in source and binary forms, with or without modification,
+// are permitted provided that the following conditions are met:
+//
+//   * Redistribution's of source code must retain the above copyright notice,
+//     this list of conditions and the following disclaimer.
+//
+//   * Redistribution's in binary form must reproduce the above copyright notice,
+//     this list of conditions and the following disclaimer in the documentation
+//     and/or other materials provided with the distribution.
+//
+//   * The name of Intel Corporation may not be used to endorse or promote products
+//     derived from this software without specific prior written permission.
+//
+// This software is provided by the copyright holders and contributors "as is" and
+// any express or implied warranties, including, but not limited to, the implied
+// warranties of merchantability and fitness for a particular purpose are disclaimed.
+// In no event shall the Intel Corporation or contributors be liable for any direct,
+// indirect, incidental, special, exemplary, or consequential damages
+// (including, but not limited to, procurement of substitute goods or services;
+// loss of use, data, or profits; or business interruption) however caused
+// and on any theory of liability, whether in contract, strict liability,
+// or tort (including negligence or otherwise) arising in any way out of
+// the use of this software, even if advised of the possibility of such damage.
+//
+//M*/
+
+#include <cmath>
+#include <cstdlib>
+#include <opencv2/core.hpp>
+
+#include "hough.hpp"
+
+
+HoughSegments::HoughSegments()
+{};
+
+void HoughSegments::operator()(const cv::Mat& input_image, std::vector<cv::Vec4i>& segments, float rho, float theta,
+    int threshold, int min_line_length, int max_line_gap)
+{
+    CV_Assert(input_image.type() == CV_8UC1);
+    const int width = input_image.cols, height = input_image.rows;
+    const int shift = 16;
+    segments.clear();
+
+    // Same accumulator dimensions as cv::HoughLinesP: the last angle is
+    // dropped when it's pi, so that lines aren't detected twice.
+    int numangle = cvFloor(CV_PI/theta) + 1;
+    if (numangle > 1 && std::fabs(CV_PI - (numangle - 1)*theta) < theta/2)
+        --numangle;
+    int numrho = cvRound(((width + height)*2 + 1)/rho);
+    float irho = 1/rho;
+
+    this->accumulator.assign(numangle*numrho, 0);
+    this->trigtab.resize(numangle*2);
+    for (int n = 0; n < numangle; n++)
+    {
+        this->trigtab[n*2] = (float)(std::cos((double)n*theta)*irho);
+        this->trigtab[n*2+1] = (float)(std::sin((double)n*theta)*irho);
+    }
+    const float *ttab = this->trigtab.data();
+
+    // Collect the foreground pixels
+    this->mask.resize(width*height);
+    this->points.clear();
+    for (int y = 0; y < height; y++)
+    {
+        const uchar *data = input_image.ptr<uchar>(y);
+        uchar *mdata = this->mask.data() + y*width;
+        for (int x = 0; x < width; x++)
+        {
+            mdata[x] = data[x] != 0;
+            if (data[x])
+                this->points.push_back(cv::Point(x, y));
+        }
+    }
+    uchar *mdata0 = this->mask.data();
+
+    // Process all the points in random order
+    cv::RNG rng((uint64)-1);
+    for (int count = this->points.size(); count > 0; count--)
+    {
+        // Choose a random point out of the remaining ones and remove it by
+        // overriding it with the last one
+        int index = rng.uniform(0, count);
+        cv::Point point = this->points[index];
+        this->points[index] = this->points[count-1];
+
+        // Skip points already assigned to a segment
+        int i = point.y, j = point.x;
+        if (!mdata0[i*width + j])
+            continue;
+
+        // Vote and find the most probable line through the point
+        int max_val = threshold - 1, max_n = 0;
+        int *adata = this->accumulator.data();
+        for (int n = 0; n < numangle; n++, adata += numrho)
+        {
+            int r = cvRound(j*ttab[n*2] + i*ttab[n*2+1]) + (numrho - 1)/2;
+            int val = ++adata[r];
+            if (max_val < val)
+            {
+                max_val = val;
+                max_n = n;
+            }
+        }
+        if (max_val < threshold)
+            continue;
+
+        // Walk along the line in fixed point arithmetic, stepping by one pixel
+        // along its major axis
+        float a = -ttab[max_n*2+1], b = ttab[max_n*2];
+        int x0 = j, y0 = i, dx0, dy0;
+        bool xflag = std::fabs(a) > std::fabs(b);
+        if (xflag)
+        {
+            dx0 = a > 0 ? 1 : -1;
+            dy0 = cvRound(b*(1 << shift)/std::fabs(a));
+            y0 = (y0 << shift) + (1 << (shift-1));
+        }
+        else
+        {
+            dy0 = b > 0 ? 1 : -1;
+            dx0 = cvRound(a*(1 << shift)/std::fabs(b));
+            x0 = (x0 << shift) + (1 << (shift-1));
+        }
+
+        // Extremities: last foreground pixels before the image border or a
+        // too large gap, in both directions
+        cv::Point line_end[2];
+        for (int k = 0; k < 2; k++)
+        {
+            int gap = 0, x = x0, y = y0, dx = k ? -dx0 : dx0, dy = k ? -dy0 : dy0;
+            for (;; x += dx, y += dy)
+            {
+                int j1 = xflag ? x : x >> shift;
+                int i1 = xflag ? y >> shift : y;
+                if (j1 < 0 || j1 >= width || i1 < 0 || i1 >= height)
+                    break;
+                if (mdata0[i1*width + j1])
+                {
+                    gap = 0;
+                    line_end[k] = cv::Point(j1, i1);
+                }
+                else if (++gap > max_line_gap)
+                    break;
+            }
+        }
+
+        bool good_line = std::abs(line_end[1].x - line_end[0].x) >= min_line_length ||
+                         std::abs(line_end[1].y - line_end[0].y) >= min_line_length;
+
+        // Remove the pixels between the extremities from the mask and, for a
+        // segment, their votes from the accumulator
+        for (int k = 0; k < 2; k++)
+        {
+            int x = x0, y = y0, dx = k ? -dx0 : dx0, dy = k ? -dy0 : dy0;
+            for (;; x += dx, y += dy)
+            {
+                int j1 = xflag ? x : x >> shift;
+                int i1 = xflag ? y >> shift : y;
+                uchar *mdata = mdata0 + i1*width + j1;
+                if (*mdata)
+                {
+                    if (good_line)
+                    {
+                        adata = this->accumulator.data();
+                        for (int n = 0; n < numangle; n++, adata += numrho)
+                        {
+                            int r = cvRound(j1*ttab[n*2] + i1*ttab[n*2+1]) + (numrho - 1)/2;
+                            adata[r]--;
+                        }
+                    }
+                    *mdata = 0;
+                }
+                if (i1 == line_end[k].y && j1 == line_end[k].x)
+                    break;
+            }
+        }
+
+        if (good_line)
+        {
+            segments.push_back(cv::Vec4i(line_end[0].x, line_end[0].y, line_end[1].x, line_end[1].y));
+        }
+    }
+}
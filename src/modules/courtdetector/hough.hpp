@@ -0,0 +1,42 @@
+// Adapted from OpenCV's HoughLinesProbabilistic, see the license notice in
+// hough.cpp.
+#pragma once
+
+#include <vector>
+#include <opencv2/core.hpp>
+
+
+/**
+ * @brief Progressive probabilistic Hough transform engine following
+ * `cv::HoughLinesP`: foreground pixels are processed in the same random order
+ * (same generator and seed), each one votes in the accumulator and, when a
+ * line gets enough votes, the segment is extracted by walking along the line
+ * from the pixel and its pixels are removed from the accumulator.
+ *
+ * `cv::HoughLinesP` allocates its accumulator, mask and point list at every
+ * call. They are kept here between calls to avoid reallocations on consecutive
+ * images of the same size.
+*/
+class HoughSegments
+{
+    public:
+        HoughSegments();
+        /**
+         * @brief performs the operation.
+         * @param input_image: 8-bit single channel image in which non zero
+         * pixels are foreground.
+         * @param segments: receives the segments (x1, y1, x2, y2).
+         * @param rho: distance step of the accumulator (in pixels).
+         * @param theta: angle step of the accumulator (in radians).
+         * @param threshold: minimum number of votes for a line.
+         * @param min_line_length: minimum length of a segment.
+         * @param max_line_gap: maximum gap between two points of a segment.
+        */
+        void operator()(const cv::Mat& input_image, std::vector<cv::Vec4i>& segments, float rho, float theta,
+            int threshold, int min_line_length, int max_line_gap);
+    private:
+        std::vector<int> accumulator;   // numangle rows of numrho votes
+        std::vector<uchar> mask;        // foreground pixels not yet assigned to a segment
+        std::vector<float> trigtab;     // cos and sin of each angle, divided by rho
+        std::vector<cv::Point> points;  // foreground pixels not yet processed
+};
@@ -1,86 +1,144 @@
 
+#include <cmath>
 #include <iostream>
+#include <algorithm>
+#include <stdexcept>
 #include <Eigen/Dense>
-#include <opencv2/calib3d.hpp>
-#include <opencv2/ximgproc.hpp>
 
 #include <utils.hpp>
 #include <court.hpp>
+#include "homography.hpp"
 #include "operations.hpp"
 
 
 
-Skeletonize::Skeletonize()
+Skeletonize::Skeletonize(int threshold, int contrast, int width):
+    thinning(Thinning({(uchar)threshold, (uchar)contrast, width}))
 {};
 
-cv::Mat Skeletonize::operator()(cv::Mat input_image, cv::Mat *debug_image)
+Skeletonize::Skeletonize(Court court, cv::Size image_size, int threshold, int contrast):
+    Skeletonize(threshold, contrast, std::max(2, cvCeil(2*court.definition().linewidth*image_size.width/court.definition().width)))
+{};
+
+cv::Mat Skeletonize::operator()(cv::Mat input_image, DebugLayer *debug_layer)
 {
     cv::Mat output_image;
-    cv::ximgproc::thinning(input_image, output_image);
-    if (debug_image != nullptr)
+    (*this)(input_image, output_image, debug_layer);
+    return output_image;
+};
+
+void Skeletonize::operator()(cv::Mat input_image, cv::Mat& output_image, DebugLayer *debug_layer)
+{
+    this->thinning(input_image, output_image);
+    if (debug_layer != nullptr)
     {
-        (*debug_image).setTo(cv::Scalar(0,255,0), output_image);
+        debug_layer->mask(output_image, cv::Scalar(0,255,0));
     }
-    return output_image;
 };
 
 
 
 RemoveSmallComponents::RemoveSmallComponents(int max_area):
-    max_area(max_area)
+    max_area(max_area), removed(0)
 {};
 
-cv::Mat RemoveSmallComponents::operator()(cv::Mat input_image, cv::Mat *debug_image)
+cv::Mat RemoveSmallComponents::operator()(cv::Mat input_image, DebugLayer *debug_layer)
 {
-    cv::Mat labeled_image, stats, centroids, mask;
-    int n_labels = connectedComponentsWithStats(input_image, labeled_image, stats, centroids);
-    int start_index = 1; // skip background component
-    for (int i = start_index; i < n_labels; ++i)
+    // Label the runs of foreground pixels. Runs are sorted by row, then by
+    // column, so the runs of the previous row that touch the current run
+    // (8-connectivity) are found by advancing a cursor.
+    this->runs.clear();
+    this->components.reset(0);
+    size_t previous_begin = 0, previous_end = 0; // runs of the previous row
+    for (int y = 0; y < input_image.rows; ++y)
     {
-        if (stats.at<int>(i, cv::CC_STAT_AREA) < this->max_area)
+        const uchar *pixels = input_image.ptr<uchar>(y);
+        size_t cursor = previous_begin;
+        for (int x = 0; x < input_image.cols; )
         {
-            cv::compare(labeled_image, i, mask, cv::CMP_EQ);
-            input_image.setTo(0, mask);
+            if (!pixels[x])
+            {
+                ++x;
+                continue;
+            }
+            Run run = {y, x, x, this->components.add()};
+            while (run.end < input_image.cols && pixels[run.end])
+                ++run.end;
+            while (cursor < previous_end && this->runs[cursor].end < run.begin)
+                ++cursor;
+            for (size_t k = cursor; k < previous_end && this->runs[k].begin <= run.end; ++k)
+                this->components.merge(run.label, this->runs[k].label);
+            this->runs.push_back(run);
+            x = run.end;
         }
+        previous_begin = previous_end;
+        previous_end = this->runs.size();
+    }
+
+    // Area of each component, accumulated on its representative
+    this->areas.assign(this->runs.size(), 0);
+    for (const Run& run : this->runs)
+    {
+        this->areas[this->components.find(run.label)] += run.end - run.begin;
+    }
+    this->removed = 0;
+    for (size_t i = 0; i < this->runs.size(); ++i)
+    {
+        this->removed += this->components.find(i) == (int)i && this->areas[i] < this->max_area;
+    }
+
+    // Clear the runs of the small components
+    for (const Run& run : this->runs)
+    {
+        if (this->areas[this->components.find(run.label)] < this->max_area)
+            std::fill(input_image.ptr<uchar>(run.row) + run.begin, input_image.ptr<uchar>(run.row) + run.end, 0);
     }
-    if (debug_image != nullptr)
+    if (debug_layer != nullptr)
     {
-        (*debug_image).setTo(cv::Scalar(0,255,0), input_image);
+        debug_layer->mask(input_image, cv::Scalar(0,255,0));
     }
     return input_image;
 };
 
+int RemoveSmallComponents::removed_components() const
+{
+    return this->removed;
+}
+
 
 
 FindSegments::FindSegments(float distance_step, float angle_step, int threshold, int min_line_length, int max_line_gap):
     distance_step(distance_step), angle_step(angle_step), threshold(threshold), min_line_length(min_line_length), max_line_gap(max_line_gap)
 {};
 
-std::vector<LineSegment> FindSegments::operator()(cv::Mat input_image, cv::Mat *debug_image)
+std::vector<LineSegment> FindSegments::operator()(cv::Mat input_image, DebugLayer *debug_layer)
+{
+    std::vector<LineSegment> segments;
+    (*this)(input_image, segments, debug_layer);
+    return segments;
+};
+
+void FindSegments::operator()(cv::Mat input_image, std::vector<LineSegment>& segments, DebugLayer *debug_layer)
 {
     // find segments
-    std::vector<cv::Vec4i> coordinates;
-    cv::HoughLinesP(input_image, coordinates, this->distance_step, this->angle_step*CV_PI/180, this->threshold,
+    this->hough(input_image, this->coordinates, this->distance_step, this->angle_step*CV_PI/180, this->threshold,
         this->min_line_length, this->max_line_gap);
 
-    int num_segments = coordinates.size();
-    std::vector<LineSegment> segments;
+    int num_segments = this->coordinates.size();
+    segments.clear();
     for (size_t i = 0; i < num_segments; i++)
     {
-        cv::Vec4i l = coordinates[i];
+        cv::Vec4i l = this->coordinates[i];
         LineSegment segment(l[0], l[1], l[2], l[3]);
         segments.push_back(segment);
 
-        if (debug_image != nullptr)
+        if (debug_layer != nullptr)
         {
             // draw segments
             cv::viz::Color color = colors[i % colors.size()];
-            std::ostringstream label;
-            label << i << " |" << (int)segment.rho << "| " << (int)(segment.theta*180/CV_PI);
-            draw_line(segment, *debug_image, color, 3, 10, label.str());
+            debug_layer->numbered_line(segment, i, color, 3, 10);
         }
     }
-    return segments;
 };
 
 
@@ -93,229 +151,882 @@ ClusterSegments::ClusterSegments(float rho_threshold, float theta_threshold):
     rho_threshold(rho_threshold), theta_threshold(theta_threshold)
 {};
 
-std::vector<LineSegment> ClusterSegments::operator()(std::vector<LineSegment> segments, cv::Mat *debug_image)
+std::vector<LineSegment> ClusterSegments::operator()(std::vector<LineSegment> segments, DebugLayer *debug_layer)
+{
+    std::vector<LineSegment> lines;
+    (*this)(segments, lines, debug_layer);
+    return lines;
+};
+
+void ClusterSegments::operator()(const std::vector<LineSegment>& segments, std::vector<LineSegment>& lines, DebugLayer *debug_layer)
 {
     int num_segments = segments.size();
 
-    // Computing full adjacency matrix is required to link segments that are not directly connected
-    Eigen::MatrixXi adjacency = Eigen::MatrixXi::Zero(num_segments, num_segments);
-    for (size_t i = 0; i < num_segments; ++i)
+    // Bucket segments on a (rho, theta) grid whose cells are at least as large
+    // as the thresholds, so that colinear segments are in neighbouring cells.
+    // Theta is taken modulo pi and wraps around.
+    int theta_bins = std::max(1, (int)(180/this->theta_threshold));
+    if (theta_bins < 3)
+        theta_bins = 1;
+    std::vector<std::pair<int, int>>& cells = this->cells; // (cell key, segment index)
+    cells.resize(num_segments);
+    for (int i = 0; i < num_segments; ++i)
     {
-        adjacency(i, i) = 1;
-        for (size_t j = i+1; j < num_segments; ++j)
+        double theta = std::fmod(segments[i].theta, CV_PI);
+        theta = theta < 0 ? theta + CV_PI : theta;
+        int theta_bin = std::min(theta_bins-1, (int)(theta/CV_PI*theta_bins));
+        int rho_bin = (int)(segments[i].rho/this->rho_threshold);
+        cells[i] = {rho_bin*theta_bins + theta_bin, i};
+    }
+    std::sort(cells.begin(), cells.end());
+
+    // Link colinear segments of neighbouring cells. Only the forward half of
+    // the neighbourhood is visited so that each pair of cells is tested once.
+    DisjointSet& connected = this->connected;
+    connected.reset(num_segments);
+    const int neighbours[][2] = {{0, 0}, {0, 1}, {1, -1}, {1, 0}, {1, 1}};
+    for (int n = 0; n < 5; ++n)
+    {
+        if (theta_bins == 1 && neighbours[n][1] != 0)
+            continue;
+        for (auto cell = cells.begin(); cell != cells.end(); )
         {
-            double rho   = std::abs(segments[i].rho - segments[j].rho);
-            double theta = std::abs(std::fmod(segments[i].theta - segments[j].theta, CV_PI))*180/CV_PI;
-            if (rho < this->rho_threshold && theta < this->theta_threshold)
+            int rho_bin = cell->first / theta_bins, theta_bin = cell->first % theta_bins;
+            auto cell_end = std::upper_bound(cell, cells.end(), std::make_pair(cell->first, num_segments));
+            int other_theta_bin = (theta_bin + neighbours[n][1] + theta_bins) % theta_bins;
+            int other_key = (rho_bin + neighbours[n][0])*theta_bins + other_theta_bin;
+            auto other = std::lower_bound(cells.begin(), cells.end(), std::make_pair(other_key, 0));
+            for (auto a = cell; a != cell_end; ++a)
             {
-                adjacency(i, j) = 1;
-                adjacency(j, i) = 1;
+                for (auto b = (n == 0 ? a+1 : other); b != cells.end() && b->first == other_key; ++b)
+                {
+                    const LineSegment &si = segments[a->second], &sj = segments[b->second];
+                    double rho   = std::abs(si.rho - sj.rho);
+                    double theta = std::abs(std::fmod(si.theta - sj.theta, CV_PI))*180/CV_PI;
+                    if (rho < this->rho_threshold && theta < this->theta_threshold)
+                        connected.merge(a->second, b->second);
+                }
             }
+            cell = cell_end;
         }
     }
 
-    // Identify colinear segments
-    Eigen::MatrixXi connected = adjacency;
-    while (true)
+    // Group colinear segments into lines, ordered by their first segment, and
+    // accumulate the sums of their least squares fit
+    this->cluster_of_root.assign(num_segments, -1);
+    this->line_of_segment.resize(num_segments);
+    this->fits.clear();
+    for (int i = 0; i < num_segments; ++i)
     {
-        Eigen::MatrixXi new_connected = connected*adjacency;
-        if (connected.cast<bool>() == new_connected.cast<bool>())
-            break;
-        connected = new_connected;
+        int root = connected.find(i);
+        if (this->cluster_of_root[root] < 0)
+        {
+            this->cluster_of_root[root] = this->fits.size();
+            const LineSegment& segment = segments[i];
+            cv::Point2f point(segment.x1, segment.y1);
+            ClusterFit fit = {0, 0, 0, 0, 0, point, point, point, point, i};
+            this->fits.push_back(fit);
+        }
+        this->line_of_segment[i] = this->cluster_of_root[root];
+        ClusterFit& fit = this->fits[this->cluster_of_root[root]];
+        const LineSegment& segment = segments[i];
+        for (cv::Point2f point : {cv::Point2f(segment.x1, segment.y1), cv::Point2f(segment.x2, segment.y2)})
+        {
+            fit.sxx += (double)point.x*point.x;
+            fit.sxy += (double)point.x*point.y;
+            fit.syy += (double)point.y*point.y;
+            fit.sx += point.x;
+            fit.sy += point.y;
+            // first extreme point in case of ties
+            if (point.x < fit.xmin.x) fit.xmin = point;
+            if (point.x > fit.xmax.x) fit.xmax = point;
+            if (point.y < fit.ymin.y) fit.ymin = point;
+            if (point.y > fit.ymax.y) fit.ymax = point;
+        }
+
+        if (debug_layer != nullptr)
+        {
+            cv::viz::Color color = colors[this->cluster_of_root[root] % colors.size()];
+            debug_layer->numbered_line(segment, i, color, 3, 10);
+        }
     }
 
-    // Group colinear segments into lines
-    std::vector<LineSegment> lines;
-    std::vector<int> indices;
-    for(int i = 0; i < connected.rows(); i++)
-        indices.push_back(i);
-    while (!indices.empty())
+    lines.clear();
+    for (const ClusterFit& fit : this->fits)
     {
-        // LineSegment in the form `mx + py = 1` to support vertical segments.
-        // Solving linear model A @ [[m],
-        //                           [p]] = b
-        int n_points = connected.row(indices[0]).count();
-        int node_index = indices[0];
-        Eigen::MatrixXf A(n_points*2, 2);
-        Eigen::MatrixXf b(n_points*2, 1); b.setOnes();
-        int k = 0;
-        for (size_t i = node_index; i < num_segments; i++)
+        // LineSegment in the form `mx + py = 1` to support vertical segments,
+        // fitted to the segments extremities (rows of A) by solving the 2x2
+        // normal equations A^T A [m, p]^T = A^T 1.
+        double determinant = fit.sxx*fit.syy - fit.sxy*fit.sxy;
+        double m, p, rho, theta;
+        if (determinant != 0)
         {
-            if (connected(node_index, i) > 0)
-            {
-                LineSegment segment = segments[i];
-                A.block<2,2>(k, 0) << segment.x1, segment.y1, segment.x2, segment.y2;
-                indices.erase(std::remove(indices.begin(), indices.end(), i), indices.end());
+            m = (fit.syy*fit.sx - fit.sxy*fit.sy)/determinant;
+            p = (fit.sxx*fit.sy - fit.sxy*fit.sx)/determinant;
+            theta = atan2(p, m);
+            rho = std::abs(p) < std::abs(m) ? std::cos(theta)/m : std::sin(theta)/p;
+        }
+        else
+        {
+            // Line through the origin, which `mx + py = 1` can't represent
+            theta = segments[fit.first].theta;
+            rho = segments[fit.first].rho;
+            m = std::cos(theta);
+            p = std::sin(theta);
+        }
+        bool along_y = std::abs(p) < std::abs(m); // use x if horizontal, y if vertical
+        cv::Point2f point1 = closest_point(rho, theta, along_y ? fit.ymin : fit.xmin);
+        cv::Point2f point2 = closest_point(rho, theta, along_y ? fit.ymax : fit.xmax);
+        lines.push_back(LineSegment(point1.x, point1.y, point2.x, point2.y));
+    }
+};
+
+const std::vector<int>& ClusterSegments::segment_lines() const
+{
+    return this->line_of_segment;
+}
+
+
+
+/**
+ * Gray level at a sub-pixel position, interpolated bilinearly. The position
+ * must be inside the image.
+*/
+static float interpolate(const cv::Mat& image, cv::Point2f point)
+{
+    int x = std::min((int)point.x, image.cols - 2), y = std::min((int)point.y, image.rows - 2);
+    float fx = point.x - x, fy = point.y - y;
+    const uchar *row0 = image.ptr<uchar>(y) + x, *row1 = image.ptr<uchar>(y + 1) + x;
+    return (1 - fy)*((1 - fx)*row0[0] + fx*row0[1]) + fy*((1 - fx)*row1[0] + fx*row1[1]);
+}
 
-                if (debug_image != nullptr)
+RefineLines::RefineLines(int band, float sampling, int min_contrast, float min_support):
+    band(band), sampling(sampling), min_contrast(min_contrast), min_support(min_support)
+{};
+
+void RefineLines::operator()(cv::Mat input_image, std::vector<LineSegment>& lines, DebugLayer *debug_layer)
+{
+    const int size = 2*this->band + 1;
+    const cv::Rect_<float> bounds(0, 0, input_image.cols - 1, input_image.rows - 1);
+    this->profile.resize(size);
+    for (size_t l = 0; l < lines.size(); l++)
+    {
+        LineSegment& line = lines[l];
+        if (line.length < this->sampling)
+            continue;
+        cv::Point2f start(line.x1, line.y1);
+        cv::Point2f direction = cv::Point2f(line.x2 - line.x1, line.y2 - line.y1)/line.length;
+        cv::Point2f normal(-direction.y, direction.x);
+        int n = (int)(line.length/this->sampling) + 1;
+
+        this->points.clear();
+        this->weights.clear();
+        for (int i = 0; i < n; i++)
+        {
+            // Profile across the line, skipped if it leaves the image
+            cv::Point2f point = start + (i*line.length/(n - 1))*direction;
+            if (!bounds.contains(point - (float)this->band*normal) || !bounds.contains(point + (float)this->band*normal))
+                continue;
+            int peak = 0;
+            float low = 255, high = 0;
+            for (int k = 0; k < size; k++)
+            {
+                float value = interpolate(input_image, point + (float)(k - this->band)*normal);
+                this->profile[k] = value;
+                low = std::min(low, value);
+                if (value > high)
                 {
-                    cv::viz::Color color = colors[lines.size()-1 % colors.size()];
-                    std::ostringstream label;
-                    label << i << " |" << (int)segment.rho << "| " << (int)(segment.theta*180/CV_PI);
-                    draw_line(segment, *debug_image, color, 3, 10, label.str());
+                    high = value;
+                    peak = k;
                 }
-                k = k + 2;
             }
+            if (high - low < this->min_contrast)
+                continue;
+
+            // Centroid of the ridge, which must be entirely in the profile
+            float half = (low + high)/2;
+            int first = peak, last = peak;
+            while (first > 0 && this->profile[first-1] >= half)
+                first--;
+            while (last < size - 1 && this->profile[last+1] >= half)
+                last++;
+            if (first == 0 || last == size - 1)
+                continue;
+            float sum = 0, offset = 0;
+            for (int k = first; k <= last; k++)
+            {
+                sum += this->profile[k] - half;
+                offset += (this->profile[k] - half)*(k - this->band);
+            }
+            this->points.push_back(point + (offset/sum)*normal);
+            this->weights.push_back((high - low)/255);
         }
 
-        // Solve linear system
-        Eigen::MatrixXf x = A.jacobiSvd(Eigen::ComputeThinU | Eigen::ComputeThinV).solve(b);
-        double m = x(0);
-        double p = x(1);
-        double theta = atan2(p, m);
-        double rho = std::abs(p) < std::abs(m) ? std::cos(theta)/m : std::sin(theta)/p;
-        int coordinate = std::abs(p) < std::abs(m) ? 1 : 0; // use x if horizontal, y if vertical
-        Eigen::Index argmax, argmin;
-        A.col(coordinate).maxCoeff(&argmax);
-        A.col(coordinate).minCoeff(&argmin);
-        cv::Point2f point1 = closest_point(rho, theta, {A(argmin, 0), A(argmin, 1)});
-        cv::Point2f point2 = closest_point(rho, theta, {A(argmax, 0), A(argmax, 1)});
-        LineSegment line(point1.x, point1.y, point2.x, point2.y);
-        lines.push_back(line);
+        if (this->points.size() < 2 || this->points.size() < this->min_support*n)
+            continue;
+        line = fit_line(this->points, this->weights);
+
+        if (debug_layer != nullptr)
+        {
+            cv::viz::Color color = colors[l % colors.size()];
+            for (cv::Point2f point : this->points)
+                debug_layer->point(point, 2, color, -1);
+            debug_layer->line(line, color, 1, 3);
+        }
     }
-    return lines;
+}
+
+
+
+/**
+ * Homography mapping the rectangle [x1, x2]x[y1, y2] of the court plane to
+ * the image quadrilateral `quad`, made of the images of (x1, y1), (x2, y1),
+ * (x2, y2) and (x1, y2): the rectangle is mapped to the unit square, which is
+ * mapped to the quadrilateral in closed form (Heckbert, "Fundamentals of
+ * Texture Mapping and Image Warping", 1989). Returns false if the
+ * quadrilateral is degenerate.
+*/
+static bool rectangle_homography(float x1, float y1, float x2, float y2, const cv::Point2f quad[4], Eigen::Matrix3d& H)
+{
+    double dx1 = quad[1].x - quad[2].x, dx2 = quad[3].x - quad[2].x, dx3 = quad[0].x - quad[1].x + quad[2].x - quad[3].x;
+    double dy1 = quad[1].y - quad[2].y, dy2 = quad[3].y - quad[2].y, dy3 = quad[0].y - quad[1].y + quad[2].y - quad[3].y;
+    double den = dx1*dy2 - dx2*dy1;
+    if (!(std::abs(den) > 1e-9)) // also rejects intersections of parallel lines
+        return false;
+    double g = (dx3*dy2 - dx2*dy3)/den, h = (dx1*dy3 - dx3*dy1)/den;
+    Eigen::Matrix3d square, rectangle;
+    square << quad[1].x - quad[0].x + g*quad[1].x, quad[3].x - quad[0].x + h*quad[3].x, quad[0].x,
+              quad[1].y - quad[0].y + g*quad[1].y, quad[3].y - quad[0].y + h*quad[3].y, quad[0].y,
+              g, h, 1;
+    rectangle << 1/(x2 - x1), 0, -x1/(x2 - x1),
+                 0, 1/(y2 - y1), -y1/(y2 - y1),
+                 0, 0, 1;
+    H = square*rectangle;
+    return true;
+}
+
+// Hypotheses explaining this fraction of the total lines length (as weighted
+// by the score) end the search
+static const float explained_fraction = 0.9;
+// The camera being behind the baseline, the transverse lines are within 20
+// degrees of the image x axis (the sidelines can be more oblique than 45
+// degrees, so LineSegment::orientation isn't used)
+static const float max_slope = std::tan(20*M_PI/180);
+
+IdentifyLines::IdentifyLines(Court court, float distance_threshold, int max_lines, int max_hypotheses, int min_lines):
+    distance_threshold(distance_threshold), max_lines(max_lines), max_hypotheses(max_hypotheses), min_lines(min_lines),
+    rectangles(court.rectangles())
+{
+    const std::vector<int>& painted = court.painted_lines();
+    for (int l : painted)
+        this->court_lines.push_back(court.lines()[l]);
+    for (int l : court.identified_lines())
+    {
+        this->identified.push_back(std::find(painted.begin(), painted.end(), l) - painted.begin());
+        this->names.push_back(court.line_names()[l]);
+    }
+    this->projected.resize(2*this->court_lines.size());
 };
 
+std::vector<LineSegment> IdentifyLines::operator()(std::vector<LineSegment> lines, DebugLayer *debug_layer)
+{
+    std::vector<LineSegment> labeled_lines;
+    (*this)(lines, labeled_lines, debug_layer);
+    return labeled_lines;
+}
 
+int IdentifyLines::match(const LineSegment& line, float *distance) const
+{
+    int best = -1;
+    float best_distance = this->distance_threshold;
+    for (size_t l = 0; l < this->court_lines.size(); l++)
+    {
+        cv::Point2f p1 = this->projected[2*l], p2 = this->projected[2*l+1];
+        float length = cv::norm(p2 - p1);
+        if (length < 1)
+            continue;
+        cv::Point2f direction = (p2 - p1)/length, normal(-direction.y, direction.x);
+        float line_distance = std::max(std::abs(normal.dot(cv::Point2f(line.x1, line.y1) - p1)),
+                                       std::abs(normal.dot(cv::Point2f(line.x2, line.y2) - p1)));
+        // The line must not extend beyond the court line, which tells apart
+        // the single sidelines from the sidelines at the serveline ends
+        float t1 = direction.dot(cv::Point2f(line.x1, line.y1) - p1);
+        float t2 = direction.dot(cv::Point2f(line.x2, line.y2) - p1);
+        if (line_distance < best_distance && std::min(t1, t2) > -this->distance_threshold && std::max(t1, t2) < length + this->distance_threshold)
+        {
+            best = l;
+            best_distance = line_distance;
+        }
+    }
+    if (distance != nullptr)
+        *distance = best_distance;
+    return best;
+}
 
-IdentifyLines::IdentifyLines(int distance_threshold):
-    distance_threshold(distance_threshold)
-{};
+float IdentifyLines::score(const Eigen::Matrix3d& H, const std::vector<LineSegment>& lines, int& count)
+{
+    for (size_t l = 0; l < this->court_lines.size(); l++)
+    {
+        for (int k = 0; k < 2; k++)
+        {
+            Eigen::Vector3d p = H*Eigen::Vector3d(this->court_lines[l][k].x, this->court_lines[l][k].y, 1);
+            if (p.z() <= 0)
+                return -1;
+            this->projected[2*l+k] = cv::Point2f(p.x()/p.z(), p.y()/p.z());
+        }
+    }
+    // Lines count less the further they are from their court line, which
+    // favors the best aligned of hypotheses shifted by one of several close
+    // parallel lines (e.g. the badminton baseline and long serviceline)
+    float score = 0, distance;
+    count = 0;
+    for (const LineSegment& line : lines)
+    {
+        if (this->match(line, &distance) >= 0)
+        {
+            score += line.length*(1 - distance/this->distance_threshold);
+            count++;
+        }
+    }
+    return score;
+}
 
-std::vector<LineSegment> IdentifyLines::operator()(std::vector<LineSegment> lines, cv::Mat *debug_image)
+void IdentifyLines::search(const std::vector<LineSegment>& lines)
 {
-    LineSegment *baseline = nullptr;
-    LineSegment *serveline = nullptr;
-    for (auto &line : lines)
+    // Candidate lines, longest first
+    this->horizontals.clear();
+    this->verticals.clear();
+    float total = 0;
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+        bool flat = std::abs(lines[i].y2 - lines[i].y1) < max_slope*std::abs(lines[i].x2 - lines[i].x1);
+        (flat ? this->horizontals : this->verticals).push_back(i);
+        total += lines[i].length;
+    }
+    auto longest = [&lines](int a, int b) { return lines[a].length > lines[b].length; };
+    for (std::vector<int> *candidates : {&this->horizontals, &this->verticals})
+    {
+        std::sort(candidates->begin(), candidates->end(), longest);
+        candidates->resize(std::min((int)candidates->size(), this->max_lines));
+    }
+
+    // The budget is shared by the court rectangles, so that courts with more
+    // of them (e.g. badminton) reach as many line quadruples as the others
+    int hypotheses = 0, max_hypotheses = this->max_hypotheses*this->rectangles.size(), count;
+    Eigen::Matrix3d H;
+    cv::Point2f quad[4];
+    for (size_t i = 0; i < this->horizontals.size(); i++)
+    for (size_t j = i + 1; j < this->horizontals.size(); j++)
     {
-        if (line.orientation == horizontal)
+        // The lower line is the closest from the camera
+        const LineSegment *furthest = &lines[this->horizontals[i]], *closest = &lines[this->horizontals[j]];
+        if (furthest->y1 + furthest->y2 > closest->y1 + closest->y2)
+            std::swap(furthest, closest);
+        for (size_t k = 0; k < this->verticals.size(); k++)
+        for (size_t l = k + 1; l < this->verticals.size(); l++)
         {
-            if (baseline == nullptr || line.length > baseline->length)
+            const LineSegment *left = &lines[this->verticals[k]], *right = &lines[this->verticals[l]];
+            if (closest->intersect_with(*left).x > closest->intersect_with(*right).x)
+                std::swap(left, right);
+            quad[0] = closest->intersect_with(*left);
+            quad[1] = closest->intersect_with(*right);
+            quad[2] = furthest->intersect_with(*right);
+            quad[3] = furthest->intersect_with(*left);
+            for (const CourtRectangle& rectangle : this->rectangles)
             {
-                serveline = baseline;
-                baseline = &line;
+                if (hypotheses++ >= max_hypotheses)
+                    return;
+                if (!rectangle_homography(rectangle.x1, rectangle.y1, rectangle.x2, rectangle.y2, quad, H))
+                    continue;
+                float score = this->score(H, lines, count);
+                if (score > this->best_score)
+                {
+                    this->best_score = score;
+                    this->best_count = count;
+                    this->best_homography = H;
+                    if (score >= explained_fraction*total)
+                        return;
+                }
             }
-            else
+        }
+    }
+}
+
+void IdentifyLines::operator()(const std::vector<LineSegment>& lines, std::vector<LineSegment>& labeled_lines, DebugLayer *debug_layer)
+{
+    this->best_score = 0;
+    this->best_count = 0;
+    this->search(lines);
+    if (this->best_count < this->min_lines)
+    {
+        throw std::runtime_error("court lines could not be identified");
+    }
+
+    // Longest line on each court line, or the projected court line
+    int count;
+    this->score(this->best_homography, lines, count);
+    labeled_lines.clear();
+    for (size_t i = 0; i < this->identified.size(); i++)
+    {
+        int l = this->identified[i];
+        labeled_lines.push_back(LineSegment(this->projected[2*l].x, this->projected[2*l].y, this->projected[2*l+1].x, this->projected[2*l+1].y));
+        float length = 0;
+        for (const LineSegment& line : lines)
+        {
+            if (line.length > length && this->match(line) == l)
             {
-                serveline = &line;
+                labeled_lines[i] = line;
+                length = line.length;
             }
         }
     }
 
-    LineSegment *left_single_sideline, *right_single_sideline, *centerline;
-    for (auto &line : lines)
+    if (debug_layer != nullptr)
+    {
+        for (size_t i = 0; i < this->identified.size(); i++)
+            debug_layer->line(labeled_lines[i], colors[i], 3, 10, this->names[i]);
+    }
+}
+
+
+
+/**
+ * Projects a 3D point with the projection matrix `P`. Returns false if the
+ * point lies behind the camera.
+*/
+static bool project_point(const cv::Mat& P, cv::Point3f point3D, cv::Point2f& point2D)
+{
+    const double *p = P.ptr<double>(0);
+    double x = p[0]*point3D.x + p[1]*point3D.y + p[2]*point3D.z + p[3];
+    double y = p[4]*point3D.x + p[5]*point3D.y + p[6]*point3D.z + p[7];
+    double z = p[8]*point3D.x + p[9]*point3D.y + p[10]*point3D.z + p[11];
+    if (z <= 0)
+        return false;
+    point2D = cv::Point2f(x/z, y/z);
+    return true;
+}
+
+TrackLines::TrackLines(Court court, int band, int steps, float min_support, int threshold):
+    band(band), steps(steps), min_support(min_support), threshold(threshold)
+{
+    for (int l : court.identified_lines())
+    {
+        this->court_lines.push_back(court.lines()[l]);
+        this->names.push_back(court.line_names()[l]);
+    }
+};
+
+std::vector<LineSegment> TrackLines::operator()(cv::Mat input_image, Calib calib, DebugLayer *debug_layer)
+{
+    std::vector<LineSegment> lines;
+    (*this)(input_image, calib, lines, debug_layer);
+    return lines;
+}
+
+void TrackLines::operator()(cv::Mat input_image, const Calib& calib, std::vector<LineSegment>& lines, DebugLayer *debug_layer)
+{
+    // Profiles reach `band` pixels on both sides of the points, which are
+    // rounded: one more pixel keeps the samples inside the image
+    cv::Rect bounds(this->band + 1, this->band + 1, input_image.cols - 2*this->band - 2, input_image.rows - 2*this->band - 2);
+
+    std::vector<cv::Point2f>& points = this->points;
+    std::vector<float>& weights = this->weights;
+    lines.clear();
+    if (bounds.width <= 0 || bounds.height <= 0)
+        return;
+    for (size_t l = 0; l < this->court_lines.size(); l++)
     {
-        if (line.orientation == vertical)
+        cv::Point3f start = this->court_lines[l][0];
+        cv::Point3f step = (1.0f/this->steps)*(this->court_lines[l][1] - this->court_lines[l][0]);
+
+        int visible = 0;
+        points.clear();
+        weights.clear();
+        for (int i = 0; i < this->steps; i++)
+        {
+            // Position and local direction of the projected line
+            cv::Point2f point, next;
+            if (!project_point(calib.P, start + (float)i*step, point) || !project_point(calib.P, start + (float)(i+1)*step, next))
+                continue;
+            cv::Point2f direction = next - point;
+            float length = cv::norm(direction);
+            if (!bounds.contains(point) || length < 1e-3)
+                continue;
+            visible++;
+            cv::Point2f normal = cv::Point2f(-direction.y, direction.x)/length;
+
+            // Intensity weighted line center along the perpendicular profile
+            float sum = 0, offset = 0, peak = 0;
+            for (int k = -this->band; k <= this->band; k++)
+            {
+                cv::Point2f sample = point + (float)k*normal;
+                float value = input_image.at<uchar>(cvRound(sample.y), cvRound(sample.x));
+                if (value >= this->threshold)
+                {
+                    sum += value;
+                    offset += value*k;
+                    peak = std::max(peak, value);
+                }
+            }
+            if (sum > 0)
+            {
+                points.push_back(point + (offset/sum)*normal);
+                weights.push_back(peak/255);
+            }
+        }
+
+        // Tracking quality check
+        if (points.size() < 2 || points.size() < this->min_support*visible)
+        {
+            lines.clear();
+            return;
+        }
+        lines.push_back(fit_line(points, weights));
+
+        if (debug_layer != nullptr)
         {
-            if (line.distance_to({serveline->x1, serveline->y1}) < this->distance_threshold)
-                left_single_sideline = &line;
-            else if (line.distance_to({serveline->x2, serveline->y2}) < this->distance_threshold)
-                right_single_sideline = &line;
-            else if (line.distance_to({(serveline->x1 + serveline->x2)/2, (serveline->y1 + serveline->y2)/2}) < distance_threshold)
-                centerline = &line;
+            for (cv::Point2f point : points)
+                debug_layer->point(point, 3, colors[l], -1);
+            debug_layer->line(lines.back(), colors[l], 3, 10, this->names[l]);
         }
     }
+}
+
 
-    if (debug_image != nullptr)
+
+SearchLines::SearchLines(Court court, float rho_window, float theta_window, float rho_step, float theta_step, float min_support, int threshold):
+    rho_window(rho_window), rho_step(rho_step), min_support(min_support), threshold(threshold)
+{
+    for (int l : court.identified_lines())
     {
-        draw_line(*serveline, *debug_image, colors[0], 3, 10, std::string("serveline"));
-        draw_line(*baseline, *debug_image, colors[1], 3, 10, std::string("baseline"));
-        draw_line(*left_single_sideline, *debug_image, colors[2], 3, 10, std::string("left_single_sideline"));
-        draw_line(*right_single_sideline, *debug_image, colors[3], 3, 10, std::string("right_single_sideline"));
-        draw_line(*centerline, *debug_image, colors[4], 3, 10, std::string("centerline"));
+        this->court_lines.push_back(court.lines()[l]);
+        this->names.push_back(court.line_names()[l]);
     }
+    int rho_half = std::max(0, cvRound(rho_window/rho_step));
+    int theta_half = std::max(0, cvRound(theta_window/theta_step));
+    this->rho_bins = 2*rho_half + 1;
+    this->theta_bins = 2*theta_half + 1;
+    this->max_angle = theta_half*theta_step*CV_PI/180;
+    for (int k = 0; k < this->theta_bins; k++)
+    {
+        double angle = (k - theta_half)*theta_step*CV_PI/180;
+        this->rotations.push_back(cv::Point2f(std::cos(angle), std::sin(angle)));
+    }
+};
 
-    lines = {*serveline, *baseline, *left_single_sideline, *right_single_sideline, *centerline};
+std::vector<LineSegment> SearchLines::operator()(cv::Mat input_image, Calib calib, DebugLayer *debug_layer)
+{
+    std::vector<LineSegment> lines;
+    (*this)(input_image, calib, lines, debug_layer);
     return lines;
 }
 
+void SearchLines::operator()(cv::Mat input_image, const Calib& calib, std::vector<LineSegment>& lines, DebugLayer *debug_layer)
+{
+    const int rho_half = this->rho_bins/2;
+
+    lines.clear();
+    for (size_t l = 0; l < this->court_lines.size(); l++)
+    {
+        // Predicted line: center, direction and normal. Each pixel of the band
+        // is visited once by scanning the minor axis of the line at every
+        // position along its major axis.
+        cv::Point2f p1, p2;
+        if (!project_point(calib.P, this->court_lines[l][0], p1) || !project_point(calib.P, this->court_lines[l][1], p2))
+        {
+            lines.clear();
+            return;
+        }
+        cv::Point2f center = 0.5f*(p1 + p2);
+        cv::Point2f direction = p2 - p1;
+        float length = cv::norm(direction);
+        direction = length > 0 ? direction/length : cv::Point2f(1, 0);
+        cv::Point2f normal(-direction.y, direction.x);
+        bool along_x = std::abs(direction.x) >= std::abs(direction.y);
+        float major1 = along_x ? p1.x : p1.y, major2 = along_x ? p2.x : p2.y;
+        float minor1 = along_x ? p1.y : p1.x;
+        float slope = along_x ? direction.y/direction.x : direction.x/direction.y;
+        float scale = 1/std::abs(along_x ? direction.x : direction.y); // minor axis length of a unit normal distance
+        int major_size = along_x ? input_image.cols : input_image.rows;
+        int minor_size = along_x ? input_image.rows : input_image.cols;
+        int begin = std::max(0, (int)std::ceil(std::min(major1, major2)));
+        int end = std::min(major_size - 1, (int)std::floor(std::max(major1, major2)));
+
+        // Vote for the lines rotated around the center within the window
+        this->accumulator.assign(this->theta_bins*this->rho_bins, 0);
+        this->points.clear();
+        this->weights.clear();
+        int visible = 0;
+        for (int major = begin; major <= end; major++)
+        {
+            float predicted = minor1 + (major - major1)*slope;
+            if (predicted < 0 || predicted > minor_size - 1)
+                continue;
+            visible++;
+            // The band widens away from the center to contain the rotated lines
+            float distance = std::abs(major - (along_x ? center.x : center.y))*scale;
+            float half = (this->rho_window + distance*std::sin(this->max_angle))*scale;
+            int first = std::max(0, (int)std::ceil(predicted - half));
+            int last = std::min(minor_size - 1, (int)std::floor(predicted + half));
+            for (int minor = first; minor <= last; minor++)
+            {
+                int x = along_x ? major : minor, y = along_x ? minor : major;
+                uchar value = input_image.ptr<uchar>(y)[x];
+                if (value < this->threshold)
+                    continue;
+                cv::Point2f offset = cv::Point2f(x, y) - center;
+                float u = offset.dot(normal), v = offset.dot(direction);
+                int *votes = this->accumulator.data();
+                for (int k = 0; k < this->theta_bins; k++, votes += this->rho_bins)
+                {
+                    float r = u*this->rotations[k].x - v*this->rotations[k].y;
+                    int bin = cvRound(r/this->rho_step) + rho_half;
+                    if (bin >= 0 && bin < this->rho_bins)
+                        votes[bin]++;
+                }
+                this->points.push_back(cv::Point2f(x, y));
+                this->weights.push_back(value/255.0f);
+            }
+        }
+
+        // Accumulator peak and its extent across the distance bins (bins with
+        // at least half of its votes), i.e. the line width. The extent is
+        // enlarged by one bin on each side: the peak angle is quantized and
+        // the line drifts across the bins along its length.
+        int peak = std::max_element(this->accumulator.begin(), this->accumulator.end()) - this->accumulator.begin();
+        int votes = this->accumulator[peak];
+        if (visible < 2 || votes < this->min_support*visible)
+        {
+            lines.clear();
+            return;
+        }
+        int k = peak/this->rho_bins, low = peak%this->rho_bins, high = low;
+        const int *row = this->accumulator.data() + k*this->rho_bins;
+        while (low > 0 && 2*row[low-1] >= votes)
+            low--;
+        while (high < this->rho_bins - 1 && 2*row[high+1] >= votes)
+            high++;
+        float r_low = (low - rho_half - 1.5f)*this->rho_step, r_high = (high - rho_half + 1.5f)*this->rho_step;
 
+        // Sub-pixel line fitted to the pixels of the peak, weighted by their
+        // intensity
+        this->inliers.clear();
+        this->inlier_weights.clear();
+        for (size_t i = 0; i < this->points.size(); i++)
+        {
+            cv::Point2f offset = this->points[i] - center;
+            float r = offset.dot(normal)*this->rotations[k].x - offset.dot(direction)*this->rotations[k].y;
+            if (r >= r_low && r <= r_high)
+            {
+                this->inliers.push_back(this->points[i]);
+                this->inlier_weights.push_back(this->weights[i]);
+            }
+        }
+        if (this->inliers.size() < 2)
+        {
+            lines.clear();
+            return;
+        }
+        LineSegment line = fit_line(this->inliers, this->inlier_weights);
 
-ComputeHomography::ComputeHomography(Court court, cv::Size image_size):
+        // Refit to the pixels around the fitted line, whose angle isn't
+        // quantized
+        float width = r_high - r_low;
+        cv::Point2f start(line.x1, line.y1);
+        cv::Point2f axis = cv::Point2f(line.x2 - line.x1, line.y2 - line.y1)/std::max(line.length, 1e-6f);
+        this->inliers.clear();
+        this->inlier_weights.clear();
+        for (size_t i = 0; i < this->points.size(); i++)
+        {
+            cv::Point2f offset = this->points[i] - start;
+            if (std::abs(offset.x*axis.y - offset.y*axis.x) <= width/2)
+            {
+                this->inliers.push_back(this->points[i]);
+                this->inlier_weights.push_back(this->weights[i]);
+            }
+        }
+        if (this->inliers.size() >= 2)
+            line = fit_line(this->inliers, this->inlier_weights);
+        lines.push_back(line);
+
+        if (debug_layer != nullptr)
+        {
+            for (cv::Point2f point : this->inliers)
+                debug_layer->point(point, 1, colors[l], -1);
+            debug_layer->line(lines.back(), colors[l], 3, 10, this->names[l]);
+        }
+    }
+}
+
+
+
+ComputeHomography::ComputeHomography(Court court, cv::Size image_size, HomographySolver solver, int iterations):
     court(court),
-    image_size(image_size)
-{};
+    image_size(image_size),
+    solver(solver),
+    iterations(iterations),
+    image_keypoints(court.keypoints().size())
+{
+    this->world_keypoints = this->court.keypoints();
+};
 
-Calib ComputeHomography::operator()(std::vector<LineSegment> lines, cv::Mat *debug_image)
-{
-/*
-Tennis court
-
-        |    ◺- left sideline
-        |   |          ◺- centerline
-        |   |         |          ◺- right sideline
-        |   |         |         |   |
-        +---+---------+---------+---+    ◁--  Net
-        |   |         |         |   |
-        |   |         |         |   |
-        |   |         |         |   |
-        |   |         |         |   |
-        |   |         |         |   |
-        |   A---------E---------B   |    ◁--  Service line
-        |   |                   |   |
-        |   |                   |   |
-        |   |                   |   |
-y-axis  |   |                   |   |
-     △  |   |                   |   |
-     |  o---C-------------------D---+    ◁--  Baseline
-    (0,0)--▷ x-axis
-*/
-    cv::Point2f A2D = lines[0].intersect_with(lines[2]); // serveline with left_sideline
-    cv::Point2f B2D = lines[0].intersect_with(lines[3]); // serveline with right_sideline
-    cv::Point2f C2D = lines[1].intersect_with(lines[2]); // baseline with left_sideline
-    cv::Point2f D2D = lines[1].intersect_with(lines[3]); // baseline with right_sideline
-    cv::Point2f E2D = lines[0].intersect_with(lines[4]); // serveline with centerline
-    std::vector<cv::Point2f> image_keypoints = {A2D, B2D, C2D, D2D, E2D};
-
-    std::vector<cv::Point3f> serveline_3D = this->court.serveline();
-    cv::Point3f A3D = serveline_3D[0];
-    cv::Point3f B3D = serveline_3D[1];
-    std::vector<cv::Point3f> world_keypoints = {
-        {     A3D.x     , A3D.y , 0}, // A
-        {     B3D.x     , B3D.y , 0}, // B
-        {     A3D.x     ,   0   , 0}, // C
-        {     B3D.x     ,   0   , 0}, // D
-        {(A3D.x+B3D.x)/2, A3D.y , 0}, // E
-    };
-
-    std::vector<std::vector<cv::Point3f>> objectPoints = {world_keypoints};
-    std::vector<std::vector<cv::Point2f>> imagePoints = {image_keypoints};
-
-    std::vector<cv::Mat> rvec, tvec;
-    cv::Mat distCoefs = cv::Mat::zeros(1, 5, CV_64F);
-    cv::Mat cameraMatrix = cv::Mat::eye(3, 3, CV_64F);
-    int flags = cv::CALIB_FIX_ASPECT_RATIO | cv::CALIB_ZERO_TANGENT_DIST | cv::CALIB_FIX_K1 | cv::CALIB_FIX_K2 | cv::CALIB_FIX_K3;
-    cv::calibrateCamera(objectPoints, imagePoints, this->image_size, cameraMatrix, distCoefs, rvec, tvec, flags=flags);
-    Calib calib = {cameraMatrix, distCoefs, rvec[0], tvec[0], this->image_size};
-
-    if (debug_image != nullptr)
+Calib ComputeHomography::operator()(std::vector<LineSegment> lines, DebugLayer *debug_layer)
+{
+    Calib calib;
+    (*this)(lines, calib, debug_layer);
+    return calib;
+}
+
+void ComputeHomography::operator()(const std::vector<LineSegment>& lines, Calib& calib, DebugLayer *debug_layer)
+{
+    // Keypoints at the intersections of the identified lines, in the order of
+    // the court model (e.g. A to E of the tennis court diagram in court.hpp)
+    const std::vector<std::pair<int, int>>& keypoint_lines = this->court.keypoint_lines();
+    for (size_t i = 0; i < keypoint_lines.size(); i++)
+        this->image_keypoints[i] = lines[keypoint_lines[i].first].intersect_with(lines[keypoint_lines[i].second]);
+
+    if (this->solver == closed_form)
+        solve_calibration(this->world_keypoints, this->image_keypoints, this->image_size, this->iterations, calib);
+    else
+        calibrate_camera(this->world_keypoints, this->image_keypoints, this->image_size).copyTo(calib);
+
+    if (debug_layer != nullptr)
     {
-        std::map<std::string, std::vector<cv::Point3f>> lines_table = {
-            {"netline", this->court.netline()},
-            {"baseline", this->court.baseline()},
-            {"serveline", this->court.serveline()},
-            {"centerline", this->court.centerline()},
-            {"left_sideline", this->court.left_sideline()},
-            {"right_sideline", this->court.right_sideline()},
-            {"left_single_sideline", this->court.left_single_sideline()},
-            {"right_single_sideline", this->court.right_single_sideline()},
-        };
-        int i = 0;
-        for (std::map<std::string, std::vector<cv::Point3f>>::iterator it = lines_table.begin(); it != lines_table.end(); it++, i++)
+        const std::vector<std::vector<cv::Point3f>>& court_lines = this->court.lines();
+        for (size_t i = 0; i < court_lines.size(); i++)
         {
-            draw_line_projected(calib, it->second[0], it->second[1], *debug_image, colors[i], 3, 10, it->first);
+            const std::vector<cv::Point3f>& line = court_lines[i];
+            debug_layer->projected_line(calib, line[0], line[1], colors[i], 3, 10, this->court.line_names()[i]);
         }
 
-        cv::circle(*debug_image, A2D, 10, cv::Scalar(0, 0, 255), 3);
-        cv::putText(*debug_image, "A", A2D, cv::FONT_HERSHEY_SIMPLEX, 1, cv::Scalar(0, 0, 255), 2);
-        cv::circle(*debug_image, B2D, 10, cv::Scalar(0, 0, 255), 3);
-        cv::putText(*debug_image, "B", B2D, cv::FONT_HERSHEY_SIMPLEX, 1, cv::Scalar(0, 0, 255), 2);
-        cv::circle(*debug_image, C2D, 10, cv::Scalar(0, 0, 255), 3);
-        cv::putText(*debug_image, "C", C2D, cv::FONT_HERSHEY_SIMPLEX, 1, cv::Scalar(0, 0, 255), 2);
-        cv::circle(*debug_image, D2D, 10, cv::Scalar(0, 0, 255), 3);
-        cv::putText(*debug_image, "D", D2D, cv::FONT_HERSHEY_SIMPLEX, 1, cv::Scalar(0, 0, 255), 2);
-        cv::circle(*debug_image, E2D, 10, cv::Scalar(0, 0, 255), 3);
-        cv::putText(*debug_image, "E", E2D, cv::FONT_HERSHEY_SIMPLEX, 1, cv::Scalar(0, 0, 255), 2);
+        for (size_t i = 0; i < this->image_keypoints.size(); i++)
+        {
+            debug_layer->point(this->image_keypoints[i], 10, cv::Scalar(0, 0, 255), 3);
+            debug_layer->text(this->image_keypoints[i], std::string(1, 'A' + i), cv::Scalar(0, 0, 255), 2);
+        }
     }
+}
+
+
+
+RefineCalibration::RefineCalibration(Court court, cv::Size image_size, float sampling, float max_distance, float loss_scale, int iterations):
+    image_size(image_size), sampling(sampling), max_distance(max_distance), loss_scale(loss_scale), iterations(iterations), error(NAN)
+{
+    this->court_lines = court.lines();
+};
+
+Calib RefineCalibration::operator()(Calib calib, std::vector<LineSegment> lines, DebugLayer *debug_layer)
+{
+    // The calibration is a copy, refined in place
+    (*this)(lines, calib, debug_layer);
     return calib;
 }
+
+void RefineCalibration::operator()(const std::vector<LineSegment>& lines, Calib& calib, DebugLayer *debug_layer)
+{
+    // Sample points along the detected lines
+    std::vector<cv::Point2f>& points = this->points;
+    std::vector<cv::Point2f>& directions = this->directions;
+    points.clear();
+    directions.clear();
+    for (const LineSegment& line : lines)
+    {
+        if (line.length == 0)
+            continue;
+        int n = std::max(2, (int)(line.length/this->sampling) + 1);
+        cv::Point2f direction((line.x2 - line.x1)/line.length, (line.y2 - line.y1)/line.length);
+        for (int i = 0; i < n; i++)
+        {
+            float t = (float)i/(n - 1)*line.length;
+            points.push_back(cv::Point2f(line.x1, line.y1) + t*direction);
+            directions.push_back(direction);
+        }
+    }
+
+    // Camera of the initial calibration, whose intrinsics are kept (e.g. the
+    // principal point estimated by cv::calibrateCamera)
+    CameraPose pose;
+    this->error = NAN;
+    if (!calib_pose(calib, pose))
+        return;
+
+    double error;
+    int inliers = refine_pose_on_lines(this->court_lines, points, directions, pose,
+        this->max_distance, this->loss_scale, this->iterations, &error, &this->workspace);
+    if (inliers < 7)
+        return;
+    this->error = error;
+    make_calib(pose, this->image_size, calib);
+
+    if (debug_layer != nullptr)
+    {
+        for (cv::Point2f point : points)
+            debug_layer->point(point, 3, cv::viz::Color::red(), -1);
+        for (size_t i = 0; i < this->court_lines.size(); i++)
+            debug_layer->projected_line(calib, this->court_lines[i][0], this->court_lines[i][1], colors[i], 2, 5, "");
+    }
+}
+
+double RefineCalibration::reprojection_error() const
+{
+    return this->error;
+}
+
+
+
+ValidateCalibration::ValidateCalibration(Court court, cv::Size image_size, int band, int steps, int threshold, int contrast):
+    band(band), steps(steps), threshold(threshold), contrast(contrast)
+{
+    for (int l : court.painted_lines())
+        this->court_lines.push_back(court.lines()[l]);
+    this->side = band + std::max(1, cvCeil(court.definition().linewidth*image_size.width/court.definition().width));
+};
+
+CalibQuality ValidateCalibration::operator()(cv::Mat input_image, const Calib& calib, DebugLayer *debug_layer)
+{
+    CalibQuality quality;
+    quality.reprojection_error = NAN;
+    (*this)(input_image, calib, quality, debug_layer);
+    return quality;
+}
+
+void ValidateCalibration::operator()(cv::Mat input_image, const Calib& calib, CalibQuality& quality, DebugLayer *debug_layer)
+{
+    const cv::Rect_<float> bounds(0, 0, input_image.cols - 1, input_image.rows - 1);
+    quality.inliers.assign(this->court_lines.size(), 0);
+    quality.samples.assign(this->court_lines.size(), 0);
+    int inliers = 0, samples = 0;
+    for (size_t l = 0; l < this->court_lines.size(); l++)
+    {
+        cv::Point2f p1, p2;
+        if (!project_point(calib.P, this->court_lines[l][0], p1) || !project_point(calib.P, this->court_lines[l][1], p2))
+            continue;
+        float length = cv::norm(p2 - p1);
+        if (length < 1)
+            continue;
+        cv::Point2f normal((p1.y - p2.y)/length, (p2.x - p1.x)/length);
+        for (int i = 0; i <= this->steps; i++)
+        {
+            cv::Point2f point = p1 + ((float)i/this->steps)*(p2 - p1);
+            if (!bounds.contains(point - (float)this->side*normal) || !bounds.contains(point + (float)this->side*normal))
+                continue;
+            int brightest = 0;
+            for (int k = -this->band; k <= this->band; k++)
+            {
+                cv::Point2f p = point + (float)k*normal;
+                brightest = std::max(brightest, (int)input_image.at<uchar>(cvRound(p.y), cvRound(p.x)));
+            }
+            cv::Point2f before = point - (float)this->side*normal, after = point + (float)this->side*normal;
+            int surroundings = std::max(input_image.at<uchar>(cvRound(before.y), cvRound(before.x)),
+                                        input_image.at<uchar>(cvRound(after.y), cvRound(after.x)));
+            bool inlier = brightest >= this->threshold && brightest - surroundings >= this->contrast;
+            quality.samples[l]++;
+            quality.inliers[l] += inlier;
+            if (debug_layer != nullptr)
+                debug_layer->point(point, 3, inlier ? cv::viz::Color::green() : cv::viz::Color::red(), -1);
+        }
+        samples += quality.samples[l];
+        inliers += quality.inliers[l];
+    }
+    quality.support = samples > 0 ? (float)inliers/samples : NAN;
+}
@@ -1,31 +1,59 @@
 #pragma once
 
+#include <Eigen/Dense>
 #include <utils.hpp>
 #include <court.hpp>
+#include <debuglayer.hpp>
+#include "thinning.hpp"
+#include "hough.hpp"
+#include "homography.hpp"
 
 
 /**
- * @brief Perform a Thinning operation.
+ * @brief Perform a Thinning operation (see Thinning) on the white lines of the
+ * input image, binarized with a LineFilter.
+ * @param threshold: minimum gray level of line pixels.
+ * @param contrast: minimum difference between line pixels and the pixels
+ * `width` pixels away on both sides. 0 keeps all pixels above the threshold.
+ * @param width: distance to the compared pixels (in pixels).
 */
 class Skeletonize
 {
     public:
-        Skeletonize();
+        Skeletonize(int threshold=128, int contrast=0, int width=0);
+        /**
+         * @brief Line filter tuned to the lines width of `court`. As the
+         * closest baseline is fully visible (see the working hypothesis), the
+         * court lines are at most `linewidth*image_size.width/width` pixels
+         * wide; pixels are compared with pixels twice that distance away to
+         * handle oblique lines.
+        */
+        Skeletonize(Court court, cv::Size image_size, int threshold, int contrast);
         /**
          * @brief performs the operation.
          * @param input_image: input image to be skeletonized.
-         * @param debug_image: if not null, a visualization of the operation is
-         * drawn on this image.
+         * @param debug_layer: if not null, a visualization of the operation is
+         * recorded in this layer.
          * @return a binary image with the skeleton of pixel blos from the input
          * image.
         */
-        cv::Mat operator()(cv::Mat input_image, cv::Mat *debug_image=nullptr);
+        cv::Mat operator()(cv::Mat input_image, DebugLayer *debug_layer=nullptr);
+        /**
+         * @brief performs the operation in an existing image, which isn't
+         * reallocated if it has the right size.
+        */
+        void operator()(cv::Mat input_image, cv::Mat& output_image, DebugLayer *debug_layer=nullptr);
     private:
+        Thinning thinning;
 };
 
 
 /**
  * @brief Removes small connected components from a binary image.
+ * Components (8-connectivity) are labeled from the runs of foreground pixels
+ * of each row: runs overlapping a run of the previous row are merged in a
+ * disjoint set. The runs and the disjoint set are kept between calls to avoid
+ * reallocations.
  * @param max_area: maximum area (in pixels) for a connected component to be
  * considered.
 */
@@ -37,13 +65,25 @@ class RemoveSmallComponents
          * @brief performs the operation (in place).
          * @param input_image: binary image in which small connected components
          * are removed.
-         * @param debug_image: if not null, a visualization of the operation is
-         * drawn on this image.
+         * @param debug_layer: if not null, a visualization of the operation is
+         * recorded in this layer.
          * @return the input binary image cleaned.
         */
-        cv::Mat operator()(cv::Mat input_image, cv::Mat *debug_image=nullptr);
+        cv::Mat operator()(cv::Mat input_image, DebugLayer *debug_layer=nullptr);
+        /**
+         * @return the number of components removed by the last call.
+        */
+        int removed_components() const;
     private:
+        typedef struct {
+            int row, begin, end; // pixels [begin, end[ of a row
+            int label;
+        } Run;
         int max_area;
+        int removed;
+        std::vector<Run> runs;
+        std::vector<int> areas;
+        DisjointSet components;
 };
 
 
@@ -63,12 +103,19 @@ class FindSegments
         /**
          * @brief performs the operation.
          * @param input_image: binary image in which line segments are searched.
-         * @param debug_image: if not null, a visualization of the operation is
-         * drawn on this image.
+         * @param debug_layer: if not null, a visualization of the operation is
+         * recorded in this layer.
          * @return line segments found in the image.
         */
-        std::vector<LineSegment> operator()(cv::Mat input_image, cv::Mat *debug_image=nullptr);
+        std::vector<LineSegment> operator()(cv::Mat input_image, DebugLayer *debug_layer=nullptr);
+        /**
+         * @brief performs the operation in an existing vector, whose capacity
+         * is reused.
+        */
+        void operator()(cv::Mat input_image, std::vector<LineSegment>& segments, DebugLayer *debug_layer=nullptr);
     private:
+        HoughSegments hough;
+        std::vector<cv::Vec4i> coordinates;
         float distance_step;
         float angle_step;
         int threshold;
@@ -91,65 +138,423 @@ class ClusterSegments
         /**
          * @brief performs the operation
          * @param segments: line segments found in the image
-         * @param debug_image: if not null, a visualization of the operation is
-         * drawn on this image.
+         * @param debug_layer: if not null, a visualization of the operation is
+         * recorded in this layer.
          * @return new line segments by clustering colinear input line segments.
         */
-        std::vector<LineSegment> operator()(std::vector<LineSegment> segments, cv::Mat *debug_image=nullptr);
+        std::vector<LineSegment> operator()(std::vector<LineSegment> segments, DebugLayer *debug_layer=nullptr);
+        /**
+         * @brief performs the operation in an existing vector, whose capacity
+         * is reused.
+        */
+        void operator()(const std::vector<LineSegment>& segments, std::vector<LineSegment>& lines, DebugLayer *debug_layer=nullptr);
+        /**
+         * @return the index of the line of each segment of the last call.
+        */
+        const std::vector<int>& segment_lines() const;
     private:
+        /**
+         * Sums of the least squares fit of a cluster line and its extreme
+         * points along x and y.
+        */
+        typedef struct {
+            double sxx, sxy, syy, sx, sy;
+            cv::Point2f xmin, xmax, ymin, ymax;
+            int first; // first segment of the cluster
+        } ClusterFit;
         float rho_threshold;
         float theta_threshold;
+        std::vector<std::pair<int, int>> cells;
+        DisjointSet connected;
+        std::vector<int> cluster_of_root;
+        std::vector<int> line_of_segment;
+        std::vector<ClusterFit> fits;
+};
+
+/**
+ * @brief Refines lines on the gray image, whose accuracy is otherwise limited
+ * by the one pixel skeleton they were detected on. At regular positions along
+ * each line, the intensity profile perpendicular to it is sampled (with
+ * bilinear interpolation) and the line center is located at sub-pixel
+ * precision as the centroid of the profile ridge (the samples above half of
+ * the profile contrast around its maximum). The line is then fitted to those
+ * centers by weighted total least squares (see fit_line), with the profile
+ * contrast as weight.
+ * @param band: half length (in pixels) of the profiles. It should be larger
+ * than half the line width and smaller than the distance between two parallel
+ * lines.
+ * @param sampling: distance (in pixels) between two profiles along a line.
+ * @param min_contrast: minimum difference between the brightest and darkest
+ * samples of a profile for it to contain a line.
+ * @param min_support: minimum fraction of the profiles of a line where its
+ * center must be found for the line to be refined. Other lines are left
+ * unchanged.
+*/
+class RefineLines
+{
+    public:
+        RefineLines(int band, float sampling, int min_contrast, float min_support);
+        /**
+         * @brief performs the operation (in place).
+         * @param input_image: gray image in which the lines were detected.
+         * @param lines: lines to refine.
+         * @param debug_layer: if not null, a visualization of the operation is
+         * recorded in this layer.
+        */
+        void operator()(cv::Mat input_image, std::vector<LineSegment>& lines, DebugLayer *debug_layer=nullptr);
+    private:
+        int band;
+        float sampling;
+        int min_contrast;
+        float min_support;
+        std::vector<float> profile;
+        std::vector<cv::Point2f> points;
+        std::vector<float> weights;
 };
 
 /**
  * @brief Identifies the lines necessary for performing the court homography
- * step. The serveline is first identified by finding the shortest horizontal
- * line. Then the two single sidelines are identified by finding the two
- * vertical lines being close to the serve line extremities. The baseline is the
- * horizontal line below the serveline. The centerline is the vertical line
- * whose extremity is the closest to the center of the serveline.
- * @param distance_threshold: maximum distance between lines and the serveline
- * endpoints to identify the two single sidelines; and maximum distance between
- * lines and the serveline midpoint to identify the centerline.
+ * step by hypothesis and verification, which copes with missing, extra and
+ * ambiguous lines. A hypothesis pairs two nearly horizontal lines with two
+ * transverse court lines (the lower one being the closest to the camera), and
+ * two other lines with two longitudinal court lines (in the same left to right
+ * order): one of the court rectangles (see Court::rectangles). Their four
+ * intersections give a homography between the court plane and the image, with
+ * which the painted court lines are projected: the hypothesis score is the
+ * total length of the lines lying on a projected court line (close to it and
+ * not extending beyond it), each weighted down by its distance to it.
+ * Hypotheses are built from the longest lines first, and the search stops when
+ * a hypothesis explains almost all the lines or after a bounded number of
+ * hypotheses.
+ * The identified lines are, for each identified court line, the longest line
+ * lying on it with the best hypothesis, or the projected court line if none
+ * does.
+ * @param court: court definition
+ * @param distance_threshold: maximum distance (in pixels) between the
+ * extremities of a line and a projected court line for the line to lie on it.
+ * @param max_lines: maximum number of nearly horizontal lines, and of other
+ * lines, used to build hypotheses.
+ * @param max_hypotheses: maximum number of hypotheses scored per court
+ * rectangle, i.e. of line quadruples tested against all the rectangles.
+ * @param min_lines: minimum number of lines lying on the court projected with
+ * the best hypothesis (including the four lines of the hypothesis).
 */
 class IdentifyLines
 {
     public:
-        IdentifyLines(int distance_threshold);
+        IdentifyLines(Court court, float distance_threshold, int max_lines=6, int max_hypotheses=200, int min_lines=5);
         /**
          * @brief performs the operation
          * @param lines: lines found in the image
-         * @param debug_image: if not null, a visualization of the operation is
-         * drawn on this image.
-         * @return the lines necessary for performing the court homography step:
-         * serveline, baseline, left_single_sideline, right_single_sideline and
-         * centerline.
+         * @param debug_layer: if not null, a visualization of the operation is
+         * recorded in this layer.
+         * @return the lines necessary for performing the court homography step,
+         * in the order of Court::identified_lines.
+         * @throws std::runtime_error if no hypothesis is supported by enough
+         * lines.
+        */
+        std::vector<LineSegment> operator()(std::vector<LineSegment> lines, DebugLayer *debug_layer=nullptr);
+        /**
+         * @brief performs the operation in an existing vector, whose capacity
+         * is reused.
+        */
+        void operator()(const std::vector<LineSegment>& lines, std::vector<LineSegment>& labeled_lines, DebugLayer *debug_layer=nullptr);
+    private:
+        /**
+         * @brief Scores the hypotheses, keeping the best one.
+        */
+        void search(const std::vector<LineSegment>& lines);
+        /**
+         * @brief Projects the court lines with the homography `H` (in
+         * `projected`) and scores it against `lines`.
+         * @param count: set to the number of lines lying on a court line.
+         * @return the score, or a negative value if the court is projected
+         * behind the camera.
+        */
+        float score(const Eigen::Matrix3d& H, const std::vector<LineSegment>& lines, int& count);
+        /**
+         * @return the index of the projected court line `line` lies on, or -1.
+         * @param distance: if not null, set to the distance between `line` and
+         * that court line.
+        */
+        int match(const LineSegment& line, float *distance=nullptr) const;
+        float distance_threshold;
+        int max_lines;
+        int max_hypotheses;
+        int min_lines;
+        std::vector<std::vector<cv::Point3f>> court_lines; // painted lines
+        std::vector<int> identified;     // index of the identified lines in court_lines
+        std::vector<std::string> names;
+        std::vector<CourtRectangle> rectangles;
+        std::vector<cv::Point2f> projected;
+        std::vector<int> horizontals;
+        std::vector<int> verticals;
+        Eigen::Matrix3d best_homography;
+        float best_score;
+        int best_count;
+};
+
+/**
+ * @brief Tracks the lines necessary for performing the court homography step
+ * from a previous calibration. Each court line is projected with the previous
+ * calibration and searched for in a narrow band around its projection: at
+ * regular positions along the projected line, the intensity profile
+ * perpendicular to it gives the line center. A line is fitted to those
+ * centers.
+ * @param court: court definition
+ * @param band: half width (in pixels) of the search band around each projected
+ * line. It should be smaller than the distance between two parallel lines.
+ * @param steps: number of positions sampled along each projected line.
+ * @param min_support: minimum fraction of the visible positions along a line
+ * where a line pixel must be found for the line to be considered tracked.
+ * @param threshold: minimum intensity for a pixel to be considered a line
+ * pixel.
+*/
+class TrackLines
+{
+    public:
+        TrackLines(Court court, int band, int steps, float min_support, int threshold);
+        /**
+         * @brief performs the operation
+         * @param input_image: gray image in which lines are searched.
+         * @param calib: calibration of a previous image.
+         * @param debug_layer: if not null, a visualization of the operation is
+         * recorded in this layer.
+         * @return the lines necessary for performing the court homography step
+         * (in the same order as IdentifyLines), or an empty vector if any of
+         * them could not be tracked.
+        */
+        std::vector<LineSegment> operator()(cv::Mat input_image, Calib calib, DebugLayer *debug_layer=nullptr);
+        /**
+         * @brief performs the operation in an existing vector, whose capacity
+         * is reused.
+        */
+        void operator()(cv::Mat input_image, const Calib& calib, std::vector<LineSegment>& lines, DebugLayer *debug_layer=nullptr);
+    private:
+        std::vector<std::vector<cv::Point3f>> court_lines;
+        std::vector<std::string> names;
+        int band;
+        int steps;
+        float min_support;
+        int threshold;
+        std::vector<cv::Point2f> points;
+        std::vector<float> weights;
+};
+
+/**
+ * @brief Tracks the lines necessary for performing the court homography step
+ * from a previous calibration with a Hough transform restricted to each
+ * predicted line: only the pixels in a band around the projected line vote,
+ * in a small accumulator covering a narrow window of distances and angles
+ * around the predicted ones. The line is then fitted to the pixels of the
+ * accumulator peak (weighted by their intensity) for a sub-pixel estimate.
+ * Every pixel of the band votes, which is cheap since the band is small.
+ * @param court: court definition
+ * @param rho_window: half width (in pixels) of the distance window around the
+ * predicted line. It should be smaller than the distance between two parallel
+ * lines.
+ * @param theta_window: half width (in degrees) of the angle window around the
+ * predicted line.
+ * @param rho_step: distance resolution of the accumulator (in pixels).
+ * @param theta_step: angle resolution of the accumulator (in degrees).
+ * @param min_support: minimum number of votes of the accumulator peak, as a
+ * fraction of the predicted line length (in pixels along its major axis).
+ * @param threshold: minimum intensity for a pixel to vote.
+*/
+class SearchLines
+{
+    public:
+        SearchLines(Court court, float rho_window, float theta_window, float rho_step, float theta_step, float min_support, int threshold);
+        /**
+         * @brief performs the operation
+         * @param input_image: gray image in which lines are searched.
+         * @param calib: calibration of a previous image.
+         * @param debug_layer: if not null, a visualization of the operation is
+         * recorded in this layer.
+         * @return the lines necessary for performing the court homography step
+         * (in the same order as IdentifyLines), or an empty vector if any of
+         * them could not be found.
+        */
+        std::vector<LineSegment> operator()(cv::Mat input_image, Calib calib, DebugLayer *debug_layer=nullptr);
+        /**
+         * @brief performs the operation in an existing vector, whose capacity
+         * is reused.
         */
-        std::vector<LineSegment> operator()(std::vector<LineSegment> lines, cv::Mat *debug_image=nullptr);
+        void operator()(cv::Mat input_image, const Calib& calib, std::vector<LineSegment>& lines, DebugLayer *debug_layer=nullptr);
     private:
-        int distance_threshold;
+        std::vector<std::vector<cv::Point3f>> court_lines;
+        std::vector<std::string> names;
+        float rho_window;
+        float rho_step;
+        float min_support;
+        int threshold;
+        int rho_bins;
+        int theta_bins;
+        float max_angle;                // angle of the window border (radians)
+        std::vector<cv::Point2f> rotations; // (cos, sin) of each angle offset
+        std::vector<int> accumulator;   // theta_bins rows of rho_bins votes
+        std::vector<cv::Point2f> points;
+        std::vector<float> weights;
+        std::vector<cv::Point2f> inliers;
+        std::vector<float> inlier_weights;
 };
 
+enum HomographySolver { closed_form, calibrate_camera_solver };
+
 /**
- * @brief Computes the homography matrix that maps a tennis court to the given
- * image.
- * @param court: tennis court definition
+ * @brief Computes the homography matrix that maps a court to the given image,
+ * from the keypoints at the intersections of the identified lines (see
+ * Court::keypoint_lines).
+ * @param court: court definition
  * @param image_size: size of the image
+ * @param solver: `closed_form` decomposes the keypoints homography and refines
+ * it (see solve_calibration), `calibrate_camera_solver` uses the slower
+ * `cv::calibrateCamera`.
+ * @param iterations: number of refinement iterations of the closed form solver
 */
 class ComputeHomography
 {
     public:
-        ComputeHomography(Court court, cv::Size image_size);
+        ComputeHomography(Court court, cv::Size image_size, HomographySolver solver=closed_form, int iterations=3);
         /**
          * @brief performs the operation
-         * @param lines: necessary lines found in the image: serveline,
-         * baseline, left_single_sideline, right_single_sideline and centerline.
-         * @param debug_image: if not null, a visualization of the operation is
-         * drawn on this image.
+         * @param lines: necessary lines found in the image, in the order of
+         * Court::identified_lines.
+         * @param debug_layer: if not null, a visualization of the operation is
+         * recorded in this layer.
          * @return the calibration parameters.
         */
-        Calib operator()(std::vector<LineSegment> lines, cv::Mat *debug_image=nullptr);
+        Calib operator()(std::vector<LineSegment> lines, DebugLayer *debug_layer=nullptr);
+        /**
+         * @brief performs the operation in an existing calibration object (see
+         * Calib::update).
+        */
+        void operator()(const std::vector<LineSegment>& lines, Calib& calib, DebugLayer *debug_layer=nullptr);
     private:
         Court court;
         cv::Size image_size;
+        HomographySolver solver;
+        int iterations;
+        std::vector<cv::Point3f> world_keypoints;
+        std::vector<cv::Point2f> image_keypoints;
+};
+
+
+/**
+ * @brief Refines a calibration using all the detected lines instead of the
+ * few keypoints used by ComputeHomography: points are sampled along the
+ * detected lines and the distances to all the projected court lines are
+ * minimized with a robust loss (see refine_pose_on_lines). The focal length
+ * and the pose are refined, the principal point of the calibration is kept.
+ * Calibrations with lens distortion are left unchanged.
+ * @param court: court definition
+ * @param image_size: size of the image
+ * @param sampling: distance (in pixels) between points sampled along detected
+ * lines.
+ * @param max_distance: maximum distance (in pixels) between a sampled point and
+ * the projected court line it's associated with.
+ * @param loss_scale: distance (in pixels) above which the loss becomes linear.
+ * @param iterations: maximum number of iterations.
+*/
+class RefineCalibration
+{
+    public:
+        RefineCalibration(Court court, cv::Size image_size, float sampling, float max_distance, float loss_scale, int iterations);
+        /**
+         * @brief performs the operation
+         * @param calib: initial calibration parameters.
+         * @param lines: lines found in the image.
+         * @param debug_layer: if not null, a visualization of the operation is
+         * recorded in this layer.
+         * @return the refined calibration parameters, or the initial ones if
+         * too few points could be associated with court lines.
+        */
+        Calib operator()(Calib calib, std::vector<LineSegment> lines, DebugLayer *debug_layer=nullptr);
+        /**
+         * @brief performs the operation in place (see Calib::update): `calib`
+         * is left unchanged if it can't be refined.
+        */
+        void operator()(const std::vector<LineSegment>& lines, Calib& calib, DebugLayer *debug_layer=nullptr);
+        /**
+         * @return the root mean square distance (in pixels) between the points
+         * sampled on the detected lines and the projected court lines after
+         * the last refinement, or NaN if the last calibration couldn't be
+         * refined.
+        */
+        double reprojection_error() const;
+    private:
+        std::vector<std::vector<cv::Point3f>> court_lines;
+        cv::Size image_size;
+        float sampling;
+        float max_distance;
+        float loss_scale;
+        int iterations;
+        double error;
+        std::vector<cv::Point2f> points;
+        std::vector<cv::Point2f> directions;
+        LineRefinementWorkspace workspace;
+};
+
+
+/**
+ * @brief Quality of a calibration on an image.
+ * @param reprojection_error: root mean square distance (in pixels) between the
+ * detected lines and the projected court lines (see RefineCalibration), or NaN
+ * if unknown.
+ * @param support: fraction of the points sampled along the projected court
+ * lines that lie on a line of the image, or NaN if no court line is visible.
+ * @param inliers: number of points lying on a line of the image, for each
+ * court line (see ValidateCalibration for the order).
+ * @param samples: number of points sampled in the image, for each court line.
+*/
+typedef struct {
+    double reprojection_error;
+    float support;
+    std::vector<int> inliers;
+    std::vector<int> samples;
+} CalibQuality;
+
+
+/**
+ * @brief Checks a calibration against an image without detecting lines: the
+ * painted court lines (see Court::painted_lines) are projected, and at regular
+ * positions along them, a point lies on a line of the image if the brightest
+ * pixel of a short profile across the projected line is bright and brighter
+ * than the pixels further on both sides (beyond the lines width). Only a few hundred pixels are read.
+ * @param court: court definition
+ * @param image_size: size of the image, from which the lines width is bounded
+ * as in Skeletonize.
+ * @param band: half length (in pixels) of the profiles, i.e. the tolerated
+ * distance between the projected and the actual lines.
+ * @param steps: number of positions sampled along each projected line.
+ * @param threshold: minimum intensity of line pixels.
+ * @param contrast: minimum difference between line pixels and the pixels on
+ * both sides.
+*/
+class ValidateCalibration
+{
+    public:
+        ValidateCalibration(Court court, cv::Size image_size, int band, int steps, int threshold, int contrast);
+        /**
+         * @brief performs the operation
+         * @param input_image: gray image.
+         * @param calib: calibration to validate.
+         * @param debug_layer: if not null, a visualization of the operation is
+         * recorded in this layer.
+         * @return the support of the calibration (its reprojection error is
+         * NaN).
+        */
+        CalibQuality operator()(cv::Mat input_image, const Calib& calib, DebugLayer *debug_layer=nullptr);
+        /**
+         * @brief performs the operation in an existing object, whose vectors
+         * capacity is reused. The reprojection error is left unchanged.
+        */
+        void operator()(cv::Mat input_image, const Calib& calib, CalibQuality& quality, DebugLayer *debug_layer=nullptr);
+    private:
+        std::vector<std::vector<cv::Point3f>> court_lines;
+        int band;
+        int side; // distance to the pixels on both sides of the line
+        int steps;
+        int threshold;
+        int contrast;
 };
@@ -0,0 +1,195 @@
+#include <stdexcept>
+#include <utils.hpp>
+
+#include "pipelinedetector.hpp"
+
+
+/**
+ * Waits until `condition` returns true: spins shortly, then yields, then sleeps
+ * to avoid burning a core when the pipeline is idle.
+*/
+template<typename Condition>
+static void wait_until(Condition condition)
+{
+    for (int i = 0; !condition(); i++)
+    {
+        if (i < 64)
+            continue;
+        else if (i < 128)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
+
+
+PipelineDetector::Stage::Stage(std::string name, int depth):
+    name(name), input(depth), busy(0)
+{}
+
+
+PipelineDetector::PipelineDetector(Court court, cv::Size image_size, int depth, int threshold, int contrast):
+    skeletonize(Skeletonize(court, image_size, threshold, contrast)),
+    remove_small_components(RemoveSmallComponents(50)),
+    find_segments(FindSegments(1, 1, 10, 100, 100)),
+    cluster_segments(ClusterSegments(50, 5)),
+    refine_lines(RefineLines(5, 5, 32, 0.5)),
+    identify_lines(IdentifyLines(court, 20)),
+    compute_homography(ComputeHomography(court, image_size)),
+    refine_calibration(RefineCalibration(court, image_size, 10, 20, 1.5, 20)),
+    output(depth),
+    stopped(false),
+    pushed(0),
+    popped(0),
+    start(std::chrono::steady_clock::now())
+{
+    std::vector<std::pair<std::string, std::function<void(Frame&)>>> operations = {
+        {"skeletonize", [this](Frame& frame) { frame.binary = this->skeletonize(frame.image); }},
+        {"remove_small_components", [this](Frame& frame) { frame.binary = this->remove_small_components(frame.binary); }},
+        {"find_segments", [this](Frame& frame) { frame.lines = this->find_segments(frame.binary); }},
+        {"cluster_segments", [this](Frame& frame) { frame.lines = this->cluster_segments(frame.lines); }},
+        {"refine_lines", [this](Frame& frame) { this->refine_lines(frame.image, frame.lines); }},
+        {"identify_lines", [this](Frame& frame) { frame.labeled_lines = this->identify_lines(frame.lines); }},
+        {"compute_homography", [this](Frame& frame) { frame.calib.reset(new Calib(this->compute_homography(frame.labeled_lines))); }},
+        {"refine_calibration", [this](Frame& frame) { *frame.calib = this->refine_calibration(*frame.calib, frame.lines); }},
+    };
+    for (auto& operation : operations)
+    {
+        this->stages.emplace_back(new Stage(operation.first, depth));
+        this->stages.back()->operation = operation.second;
+    }
+    for (size_t i = 0; i < this->stages.size(); i++)
+    {
+        this->threads.emplace_back(&PipelineDetector::run, this, i);
+    }
+}
+
+
+PipelineDetector::~PipelineDetector()
+{
+    this->stop();
+}
+
+
+void PipelineDetector::stop()
+{
+    this->stopped = true;
+    for (std::thread& thread : this->threads)
+    {
+        if (thread.joinable() && thread.get_id() != std::this_thread::get_id())
+            thread.join();
+    }
+}
+
+
+size_t PipelineDetector::capacity() const
+{
+    // Each stage holds an image besides its input queue
+    size_t capacity = this->output.capacity();
+    for (const std::unique_ptr<Stage>& stage : this->stages)
+    {
+        capacity += stage->input.capacity() + 1;
+    }
+    return capacity;
+}
+
+
+void PipelineDetector::run(int index)
+{
+    try
+    {
+        this->process(index);
+    }
+    catch (...)
+    {
+        // Errors of the operations travel with the frames: a stage only dies
+        // if moving frames fails, and then stops the whole pipeline
+        this->stopped = true;
+    }
+}
+
+
+void PipelineDetector::process(int index)
+{
+    Stage& stage = *this->stages[index];
+    SpscQueue<Frame>& next = index + 1 < (int)this->stages.size() ? this->stages[index+1]->input : this->output;
+    Frame frame;
+    while (true)
+    {
+        wait_until([&] { return this->stopped || stage.input.try_pop(frame); });
+        if (this->stopped)
+            return;
+
+        if (!frame.error)
+        {
+            auto begin = std::chrono::steady_clock::now();
+            try
+            {
+                stage.operation(frame);
+            }
+            catch (...)
+            {
+                frame.error = std::current_exception();
+            }
+            stage.busy += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+        }
+
+        wait_until([&] { return this->stopped || next.try_push(frame); });
+    }
+}
+
+
+void PipelineDetector::push(cv::Mat image)
+{
+    // Until pop is called from another thread, both are assumed to be called
+    // from this one
+    this->push_thread = std::this_thread::get_id();
+    std::thread::id pop_thread = this->pop_thread;
+    bool same_thread = pop_thread == std::thread::id() || pop_thread == std::this_thread::get_id();
+    if (this->pushed - this->popped >= this->capacity() && same_thread)
+    {
+        throw std::logic_error("the pipeline is full: pop calibrations before pushing more images");
+    }
+    Frame frame;
+    frame.image = image;
+    wait_until([&] { return this->stopped || this->stages.front()->input.try_push(frame); });
+    if (this->stopped)
+    {
+        throw std::runtime_error("the pipeline is stopped");
+    }
+    this->pushed++;
+}
+
+
+Calib PipelineDetector::pop()
+{
+    this->pop_thread = std::this_thread::get_id();
+    if (this->pushed == this->popped && this->push_thread == std::this_thread::get_id())
+    {
+        throw std::logic_error("no image to pop: push images first");
+    }
+    Frame frame;
+    wait_until([&] { return this->stopped || this->output.try_pop(frame); });
+    if (this->stopped)
+    {
+        throw std::runtime_error("the pipeline is stopped");
+    }
+    this->popped++;
+    if (frame.error)
+    {
+        std::rethrow_exception(frame.error);
+    }
+    return *frame.calib;
+}
+
+
+std::vector<StageOccupancy> PipelineDetector::occupancy() const
+{
+    double elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - this->start).count();
+    std::vector<StageOccupancy> occupancy;
+    for (const std::unique_ptr<Stage>& stage : this->stages)
+    {
+        occupancy.push_back({stage->name, stage->busy/elapsed, stage->input.size()});
+    }
+    return occupancy;
+}
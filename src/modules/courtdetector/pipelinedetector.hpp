@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <utils.hpp>
+#include <spscqueue.hpp>
+#include "operations.hpp"
+
+/**
+ * @brief Occupancy of a pipeline stage
+ * @param name: stage name
+ * @param busy: fraction of the time spent processing images
+ * @param queued: number of images waiting in the stage input queue
+*/
+typedef struct {
+    std::string name;
+    double busy;
+    size_t queued;
+} StageOccupancy;
+
+
+/**
+ * @brief Module detecting tennis courts on consecutive images like the full
+ * detection of CourtDetector, but with each operation running in its own
+ * thread: while an image goes through the homography computation, the next
+ * ones go through the previous operations. Stages are connected by bounded
+ * lock-free queues. The operations are the same as in CourtDetector; as images
+ * are processed concurrently, the lines can't be tracked from the previous
+ * image calibration.
+ * @param court Court object representing the current tenis court to detect.
+ * @param image_size Size of the input images
+ * @param depth Capacity of the queue in front of each stage
+ * @param threshold Minimum gray level of line pixels (see CourtDetector)
+ * @param contrast Minimum difference between line pixels and the pixels on
+ * both sides of the line (see CourtDetector)
+*/
+class PipelineDetector
+{
+    public:
+        PipelineDetector(Court court, cv::Size image_size, int depth=2, int threshold=128, int contrast=20);
+        /**
+         * @brief Stops the stage threads. Images still in the pipeline are
+         * dropped.
+        */
+        ~PipelineDetector();
+        PipelineDetector(const PipelineDetector&) = delete;
+        PipelineDetector& operator=(const PipelineDetector&) = delete;
+        /**
+         * @brief Pushes an image in the pipeline, waiting for room in the first
+         * queue if needed. Must always be called from the same thread. When
+         * images are pushed and popped from the same thread (assumed until pop
+         * is called from another thread), at most capacity() images can be
+         * pushed ahead: pushing more would wait forever, and is reported as an
+         * error.
+         * @param image Gray image. Its content must not be modified until its
+         * calibration is popped.
+         * @throws std::logic_error if the pipeline is full and calibrations
+         * are popped from this thread, std::runtime_error if the pipeline is
+         * stopped (see stop).
+        */
+        void push(cv::Mat image);
+        /**
+         * @brief Pops the calibration of the oldest pushed image, waiting for
+         * it if needed. Must always be called from the same thread. Exceptions
+         * raised while processing the image are rethrown.
+         * @throws std::logic_error if no image is waiting and images are only
+         * pushed from this thread, std::runtime_error if the pipeline is
+         * stopped (see stop).
+        */
+        Calib pop();
+        /**
+         * @brief Stops the stage threads and releases the callers waiting in
+         * push or pop, which throw. Images still in the pipeline are dropped.
+         * The pipeline also stops if a stage thread fails to pass an image to
+         * the next stage.
+        */
+        void stop();
+        /**
+         * @return the number of images the pipeline holds: the queues and the
+         * images being processed.
+        */
+        size_t capacity() const;
+        /**
+         * @return the occupancy of each stage since the pipeline creation.
+        */
+        std::vector<StageOccupancy> occupancy() const;
+    private:
+        struct Frame
+        {
+            cv::Mat image;
+            cv::Mat binary;
+            std::vector<LineSegment> lines;
+            std::vector<LineSegment> labeled_lines;
+            std::unique_ptr<Calib> calib;
+            std::exception_ptr error;
+        };
+        struct Stage
+        {
+            Stage(std::string name, int depth);
+            std::string name;
+            SpscQueue<Frame> input;
+            std::atomic<long long> busy; // in nanoseconds
+            std::function<void(Frame&)> operation;
+        };
+        void run(int index);
+        void process(int index);
+        Skeletonize skeletonize;
+        RemoveSmallComponents remove_small_components;
+        FindSegments find_segments;
+        ClusterSegments cluster_segments;
+        RefineLines refine_lines;
+        IdentifyLines identify_lines;
+        ComputeHomography compute_homography;
+        RefineCalibration refine_calibration;
+        std::vector<std::unique_ptr<Stage>> stages;
+        SpscQueue<Frame> output;
+        std::vector<std::thread> threads;
+        std::atomic<bool> stopped;
+        // Images pushed and popped, and the threads calling push and pop
+        std::atomic<size_t> pushed;
+        std::atomic<size_t> popped;
+        std::atomic<std::thread::id> push_thread;
+        std::atomic<std::thread::id> pop_thread;
+        std::chrono::steady_clock::time_point start;
+};
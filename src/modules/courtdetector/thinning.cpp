@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <opencv2/core/mat.hpp>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "thinning.hpp"
+
+
+/**
+ * Lookup tables telling whether a foreground pixel is removed by the first or
+ * the second Zhang-Suen sub-iteration, given its 8 neighbors. Neighbors are
+ * numbered as in the original paper
+ *     p9 p2 p3
+ *     p8 p1 p4
+ *     p7 p6 p5
+ * and p2, p3, ..., p9 are respectively stored in bits 0, 1, ..., 7 of the
+ * lookup table index.
+*/
+struct ZhangSuenTables
+{
+    uchar remove[2][256];
+    ZhangSuenTables()
+    {
+        for (int code = 0; code < 256; code++)
+        {
+            int p[9]; // p[0] to p[7] hold p2 to p9, p[8] wraps to p2
+            for (int k = 0; k < 8; k++)
+                p[k] = (code >> k) & 1;
+            p[8] = p[0];
+
+            int A = 0, B = 0; // number of 01 patterns, number of foreground neighbors
+            for (int k = 0; k < 8; k++)
+            {
+                A += (p[k] == 0 && p[k+1] == 1);
+                B += p[k];
+            }
+            int p2 = p[0], p4 = p[2], p6 = p[4], p8 = p[6];
+            bool common = A == 1 && B >= 2 && B <= 6;
+            this->remove[0][code] = common && p2*p4*p6 == 0 && p4*p6*p8 == 0;
+            this->remove[1][code] = common && p2*p4*p8 == 0 && p2*p6*p8 == 0;
+        }
+    }
+};
+
+static const ZhangSuenTables tables;
+
+
+/**
+ * Saturated difference, as `_mm_subs_epu8`.
+*/
+static inline int subs(int a, int b)
+{
+    return a > b ? a - b : 0;
+}
+
+/**
+ * Binarizes row `y` of `input_image` with `filter` into `binary` (0 or 1).
+ * Compared pixels outside of the image are replaced by the pixel itself, which
+ * has no contrast with it.
+*/
+static void binarize_row(const cv::Mat& input_image, int y, const LineFilter& filter, uchar *binary)
+{
+    int rows = input_image.rows, cols = input_image.cols, w = filter.width;
+    bool vertical = y - w >= 0 && y + w < rows;
+    const uchar *center = input_image.ptr<uchar>(y);
+    const uchar *up = vertical ? input_image.ptr<uchar>(y - w) : center;
+    const uchar *down = vertical ? input_image.ptr<uchar>(y + w) : center;
+    auto binarize = [&](int x) {
+        int c = center[x];
+        int horizontal = x - w >= 0 && x + w < cols ? std::min(subs(c, center[x-w]), subs(c, center[x+w])) : 0;
+        int difference = std::max(horizontal, std::min(subs(c, up[x]), subs(c, down[x])));
+        return (uchar)(c >= filter.threshold && difference >= filter.contrast);
+    };
+
+    int x = 0;
+    for (; x < std::min(w, cols); x++)
+        binary[x] = binarize(x);
+#if defined(__SSE2__)
+    // Unsigned bytes comparisons: a >= b if max(a, b) == a
+    const __m128i threshold = _mm_set1_epi8((char)filter.threshold);
+    const __m128i contrast = _mm_set1_epi8((char)filter.contrast);
+    const __m128i one = _mm_set1_epi8(1);
+    for (; x + 16 + w <= cols; x += 16)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i*)(center + x));
+        __m128i horizontal = _mm_min_epu8(_mm_subs_epu8(c, _mm_loadu_si128((const __m128i*)(center + x - w))),
+                                          _mm_subs_epu8(c, _mm_loadu_si128((const __m128i*)(center + x + w))));
+        __m128i vertical = _mm_min_epu8(_mm_subs_epu8(c, _mm_loadu_si128((const __m128i*)(up + x))),
+                                        _mm_subs_epu8(c, _mm_loadu_si128((const __m128i*)(down + x))));
+        __m128i difference = _mm_max_epu8(horizontal, vertical);
+        __m128i foreground = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(c, threshold), c),
+                                           _mm_cmpeq_epi8(_mm_max_epu8(difference, contrast), difference));
+        _mm_storeu_si128((__m128i*)(binary + x), _mm_and_si128(foreground, one));
+    }
+#endif
+    for (; x < cols; x++)
+        binary[x] = binarize(x);
+}
+
+
+Thinning::Thinning(LineFilter filter):
+    filter(filter)
+{};
+
+void Thinning::activate(int index)
+{
+    if (this->image[index] && !this->active[index])
+    {
+        this->active[index] = 1;
+        this->border.push_back(index);
+    }
+}
+
+void Thinning::operator()(const cv::Mat& input_image, cv::Mat& output_image)
+{
+    CV_Assert(input_image.type() == CV_8UC1);
+    int rows = input_image.rows;
+    int cols = input_image.cols;
+
+    this->image.resize(rows*cols);
+    this->active.assign(rows*cols, 0);
+    const uchar *image = this->image.data();
+
+    // Offsets of p2, p3, ..., p9 relative to p1
+    const int offsets[8] = {-cols, -cols+1, 1, cols+1, cols, cols-1, -1, -cols-1};
+    auto neighborhood = [&](int index) {
+        const uchar *p = image + index;
+        return p[offsets[0]]      | p[offsets[1]] << 1 | p[offsets[2]] << 2 | p[offsets[3]] << 3 |
+               p[offsets[4]] << 4 | p[offsets[5]] << 5 | p[offsets[6]] << 6 | p[offsets[7]] << 7;
+    };
+
+    // Binarize, and find the initial border pixels (foreground pixels with a
+    // background neighbor) of the previous row, whose neighborhood is then
+    // binarized. Image boundary pixels are never removed: they are flagged as
+    // active once and for all so that they never enter the border list.
+    this->border.clear();
+    for (int y = 0; y < rows; y++)
+    {
+        binarize_row(input_image, y, this->filter, &this->image[y*cols]);
+        uchar *active = &this->active[y*cols];
+        active[0] = active[cols-1] = 1;
+        if (y == 0 || y == rows-1)
+            std::fill(active, active + cols, 1);
+
+        for (int x = 1, index = (y-1)*cols + 1; y >= 2 && x < cols-1; x++, index++)
+        {
+            if (image[index] && neighborhood(index) != 0xFF)
+                this->activate(index);
+        }
+    }
+
+    // Alternate both sub-iterations until none removes any pixel. Within a
+    // sub-iteration, decisions are taken on the image before any removal.
+    size_t changed;
+    do
+    {
+        changed = 0;
+        for (int iter = 0; iter < 2; iter++)
+        {
+            const uchar *remove = tables.remove[iter];
+            this->removed.clear();
+            for (int index : this->border)
+            {
+                if (remove[neighborhood(index)])
+                    this->removed.push_back(index);
+            }
+            if (this->removed.empty())
+                continue;
+            changed += this->removed.size();
+
+            for (int index : this->removed)
+                this->image[index] = 0;
+
+            size_t n = 0;
+            for (int index : this->border)
+            {
+                if (image[index])
+                    this->border[n++] = index;
+            }
+            this->border.resize(n);
+
+            for (int index : this->removed)
+            {
+                for (int k = 0; k < 8; k++)
+                    this->activate(index + offsets[k]);
+            }
+        }
+    }
+    while (changed > 0);
+
+    output_image.create(rows, cols, CV_8UC1);
+    for (int y = 0; y < rows; y++)
+    {
+        const uchar *binary = &image[y*cols];
+        uchar *output = output_image.ptr<uchar>(y);
+        for (int x = 0; x < cols; x++)
+            output[x] = binary[x] ? 255 : 0;
+    }
+}
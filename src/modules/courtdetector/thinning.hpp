@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include <opencv2/core/mat.hpp>
+
+
+/**
+ * @brief White line filter binarizing the thinning input: a pixel is
+ * foreground if it is greater or equal to `threshold` and brighter by at least
+ * `contrast` than both pixels `width` pixels away from it, either horizontally
+ * or vertically (court lines are brighter than the ground on both sides, unlike
+ * large bright areas). With a contrast of 0, this is a plain threshold.
+ * @param threshold: minimum gray level of foreground pixels
+ * @param contrast: minimum difference with the compared pixels
+ * @param width: distance to the compared pixels (in pixels), which should be
+ * larger than the lines width
+*/
+typedef struct {
+    uchar threshold;
+    uchar contrast;
+    int width;
+} LineFilter;
+
+
+/**
+ * @brief Zhang-Suen thinning engine producing the same skeleton as
+ * `cv::ximgproc::thinning` with `THINNING_ZHANGSUEN`, which is much slower
+ * because it runs full passes over the image until convergence.
+ *
+ * Each sub-iteration decision only depends on the 3x3 neighborhood of a pixel,
+ * which is encoded as an 8-bit index into a precomputed lookup table. Only
+ * pixels on the border of foreground blobs can be removed, so the engine keeps
+ * a list of active border pixels and only visits those: a pixel enters the list
+ * when one of its neighbors is removed and leaves it when removed itself.
+ * Buffers are kept between calls to avoid reallocations on consecutive images
+ * of the same size.
+ *
+ * The input is binarized with a LineFilter (SSE2 vectorized) while it is
+ * loaded, and the initial border pixels are found in the same pass, a row
+ * behind, so that the input image is only read once.
+ * @param filter: binarization of the input. The default filter keeps pixels
+ * greater or equal to 128, as `cv::ximgproc::thinning`.
+*/
+class Thinning
+{
+    public:
+        Thinning(LineFilter filter={128, 0, 0});
+        /**
+         * @brief performs the operation.
+         * @param input_image: 8-bit single channel image, binarized with the
+         * filter.
+         * @param output_image: binary image (0 or 255) receiving the skeleton.
+        */
+        void operator()(const cv::Mat& input_image, cv::Mat& output_image);
+    private:
+        /**
+         * @brief Adds the interior foreground pixel at `index` to the active
+         * border pixels unless it's already there.
+        */
+        void activate(int index);
+        LineFilter filter;
+        std::vector<uchar> image;   // binary image (0 or 1)
+        std::vector<uchar> active;  // whether a pixel is in `border`
+        std::vector<int> border;    // indices of active border pixels
+        std::vector<int> removed;   // indices of pixels removed in a sub-iteration
+};
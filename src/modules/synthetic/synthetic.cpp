@@ -0,0 +1,141 @@
+#include <cmath>
+#include <limits>
+#include <Eigen/Dense>
+#include <homography.hpp>
+
+#include "synthetic.hpp"
+
+
+// Margin of the noise bank around the image size: images start from a random
+// window of the bank.
+static const int bank_margin = 64;
+// Gray levels of the court background and lines
+static const int background_level = 60;
+static const int line_level = 210;
+// Precision bits used for sub-pixel drawing
+static const int shift = 4;
+
+
+static cv::Point to_fixed_point(cv::Point2f point)
+{
+    return cv::Point(cvRound(point.x*(1 << shift)), cvRound(point.y*(1 << shift)));
+}
+
+
+SyntheticGenerator::SyntheticGenerator(Court court, cv::Size image_size, SyntheticParameters parameters, unsigned seed):
+    image_size(image_size), parameters(parameters), generator(seed)
+{
+    // The net is not painted on the ground
+    for (int l : court.painted_lines())
+        this->court_lines.push_back(court.lines()[l]);
+    this->court_width = court.definition().width;
+    this->noise_bank.create(image_size.height + bank_margin, image_size.width + bank_margin, CV_8UC1);
+    cv::RNG rng(seed + 1);
+    rng.fill(this->noise_bank, cv::RNG::NORMAL, cv::Scalar(background_level), cv::Scalar(parameters.noise));
+}
+
+
+float SyntheticGenerator::uniform(float min, float max)
+{
+    return std::uniform_real_distribution<float>(min, max)(this->generator);
+}
+
+
+Calib SyntheticGenerator::operator()(cv::Mat& image)
+{
+    const SyntheticParameters& parameters = this->parameters;
+    const int width = this->image_size.width, height = this->image_size.height;
+
+    // Random camera behind the baseline, looking at the middle of the closest
+    // service boxes.
+    float center = this->court_width/2;
+    Eigen::Vector3d C(center + this->uniform(-parameters.lateral, parameters.lateral),
+                      -this->uniform(parameters.distance_min, parameters.distance_max),
+                      this->uniform(parameters.height_min, parameters.height_max));
+    Eigen::Vector3d target(center, 5, 0);
+    Eigen::Vector3d z = (target - C).normalized();
+    Eigen::Vector3d x = z.cross(Eigen::Vector3d(0, 0, 1)).normalized();
+    Eigen::Vector3d y = z.cross(x);
+    CameraPose pose;
+    pose.focal = this->uniform(parameters.focal_min, parameters.focal_max)*width;
+    pose.cx = (width - 1)*0.5;
+    pose.cy = (height - 1)*0.5;
+    pose.R << x.transpose(), y.transpose(), z.transpose();
+    pose.t = -pose.R*C;
+    Calib calib = make_calib(pose, this->image_size);
+
+    // Background from a random window of the noise bank
+    int dx = this->generator()%bank_margin, dy = this->generator()%bank_margin;
+    this->noise_bank(cv::Rect(dx, dy, width, height)).copyTo(image);
+
+    // Distractors, below the court lines
+    for (int i = 0; i < parameters.distractors; i++)
+    {
+        cv::Point2f start(this->uniform(0, width), this->uniform(0, height));
+        float angle = this->uniform(0, M_PI), length = this->uniform(0.05, 0.3)*width;
+        cv::Point2f end = start + length*cv::Point2f(std::cos(angle), std::sin(angle));
+        int thickness = std::max(1, (int)(this->uniform(0.001, 0.004)*width));
+        cv::line(image, to_fixed_point(start), to_fixed_point(end), cv::Scalar(this->uniform(150, 230)), thickness, cv::LINE_AA, shift);
+    }
+
+    // Court lines as projected quads
+    float linewidth = this->uniform(parameters.linewidth_min, parameters.linewidth_max);
+    for (const std::vector<cv::Point3f>& line : this->court_lines)
+    {
+        cv::Point3f direction = line[1] - line[0];
+        cv::Point3f normal = linewidth/2/cv::norm(direction)*cv::Point3f(-direction.y, direction.x, 0);
+        std::vector<cv::Point2f> corners = calib.project({line[0] - normal, line[1] - normal, line[1] + normal, line[0] + normal});
+        std::vector<cv::Point> polygon;
+        for (cv::Point2f corner : corners)
+            polygon.push_back(to_fixed_point(corner));
+        cv::fillConvexPoly(image, polygon, cv::Scalar(line_level), cv::LINE_AA, shift);
+    }
+
+    // Clutter
+    int radius = std::max(1, width/400);
+    for (int i = 0; i < parameters.clutter; i++)
+    {
+        cv::Point2f position(this->uniform(0, width), this->uniform(0, height));
+        cv::circle(image, to_fixed_point(position), radius << shift, cv::Scalar(this->uniform(180, 240)), -1, cv::LINE_AA, shift);
+    }
+
+    // Blur
+    float sigma = this->uniform(0, parameters.blur_max);
+    if (sigma > 0.3)
+    {
+        cv::GaussianBlur(image, image, cv::Size(0, 0), sigma);
+    }
+    return calib;
+}
+
+
+double reprojection_distance(Court court, const cv::Mat& truth, const cv::Mat& estimate, cv::Size image_size)
+{
+    const std::vector<std::vector<cv::Point3f>>& lines = court.lines();
+    const double *T = truth.ptr<double>(0), *E = estimate.ptr<double>(0);
+    double total = 0;
+    int count = 0;
+    for (const std::vector<cv::Point3f>& line : lines)
+    {
+        int steps = std::max(1, (int)(cv::norm(line[1] - line[0])/0.1));
+        for (int i = 0; i <= steps; i++)
+        {
+            cv::Point3f p = line[0] + (float)i/steps*(line[1] - line[0]);
+            double zt = T[8]*p.x + T[9]*p.y + T[10]*p.z + T[11];
+            double ze = E[8]*p.x + E[9]*p.y + E[10]*p.z + E[11];
+            if (zt <= 0)
+                continue;
+            double xt = (T[0]*p.x + T[1]*p.y + T[2]*p.z + T[3])/zt;
+            double yt = (T[4]*p.x + T[5]*p.y + T[6]*p.z + T[7])/zt;
+            if (xt < 0 || yt < 0 || xt > image_size.width - 1 || yt > image_size.height - 1)
+                continue;
+            if (ze <= 0)
+                return std::numeric_limits<double>::infinity();
+            double xe = (E[0]*p.x + E[1]*p.y + E[2]*p.z + E[3])/ze;
+            double ye = (E[4]*p.x + E[5]*p.y + E[6]*p.z + E[7])/ze;
+            total += std::hypot(xe - xt, ye - yt);
+            count++;
+        }
+    }
+    return count > 0 ? total/count : std::numeric_limits<double>::infinity();
+}
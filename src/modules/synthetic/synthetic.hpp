@@ -0,0 +1,91 @@
+#pragma once
+
+#include <random>
+#include <vector>
+#include <utils.hpp>
+#include <court.hpp>
+#include <opencv2/opencv.hpp>
+
+
+/**
+ * @brief Ranges of the random variations of synthetic images. Each image draws
+ * its values uniformly in [min, max].
+ * @param distance_min, distance_max: camera distance behind the baseline (m)
+ * @param height_min, height_max: camera height (m)
+ * @param lateral: maximum camera offset from the court center along the
+ * baseline (m)
+ * @param focal_min, focal_max: focal length, relative to the image width
+ * @param linewidth_min, linewidth_max: court lines width (m)
+ * @param noise: standard deviation of the background gaussian noise (gray
+ * levels)
+ * @param blur_max: maximum standard deviation of the gaussian blur applied to
+ * the image (pixels)
+ * @param distractors: number of random bright line segments (e.g. logos,
+ * shadows edges, players)
+ * @param clutter: number of small bright spots (e.g. balls, marks)
+*/
+typedef struct {
+    float distance_min, distance_max;
+    float height_min, height_max;
+    float lateral;
+    float focal_min, focal_max;
+    float linewidth_min, linewidth_max;
+    float noise;
+    float blur_max;
+    int distractors;
+    int clutter;
+} SyntheticParameters;
+
+
+/**
+ * @brief Broadcast-like camera behind the baseline framing the closest half of
+ * the court, as in assets/image.raw, without distractors.
+*/
+const SyntheticParameters broadcast_camera = {18, 22, 11, 13, 1, 2.1, 2.5, 0.04, 0.06, 8, 1, 0, 200};
+
+
+/**
+ * @brief Generates random gray images of a tennis court with their ground
+ * truth calibration: the court lines are projected with `Calib::project` and
+ * drawn in white on a noisy background, with distractors, clutter and blur.
+ * The noise is drawn once in a bank larger than the images and each image
+ * starts from a random window of it, so that images are generated at memory
+ * bandwidth when there is no blur.
+ * @param court Court object representing the tennis court to render.
+ * @param image_size Size of the generated images
+ * @param parameters Ranges of the random variations
+ * @param seed Random seed: the same seed generates the same images.
+*/
+class SyntheticGenerator
+{
+    public:
+        SyntheticGenerator(Court court, cv::Size image_size, SyntheticParameters parameters, unsigned seed=0);
+        /**
+         * @brief Generates the next image.
+         * @param image: output image, only allocated if it doesn't have the
+         * right size and type.
+         * @return the ground truth calibration of the image.
+        */
+        Calib operator()(cv::Mat& image);
+    private:
+        float uniform(float min, float max);
+        std::vector<std::vector<cv::Point3f>> court_lines;
+        float court_width;
+        cv::Size image_size;
+        SyntheticParameters parameters;
+        std::mt19937 generator;
+        cv::Mat noise_bank;
+};
+
+
+/**
+ * @brief Measures the distance between two calibrations in image space: the
+ * mean distance between the projections of points sampled every 10 cm along
+ * the court lines, over the points projected inside the image by `truth`.
+ * @param court: tennis court
+ * @param truth: ground truth projection matrix (3x4, CV_64F)
+ * @param estimate: estimated projection matrix (3x4, CV_64F)
+ * @param image_size: size of the image
+ * @return the mean distance (in pixels), or infinity if no point is visible.
+*/
+double reprojection_distance(Court court, const cv::Mat& truth, const cv::Mat& estimate, cv::Size image_size);
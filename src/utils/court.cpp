@@ -1,100 +1,131 @@
-
-#include <map>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
 #include "court.hpp"
 
-std::map<std::string, CourtDefinition> court_definitions = {
-    {"ITF", {23.77, 10.97, 8.23, 6.40, 0.05}},
+
+// Out-of-line definitions of the model tables referenced at runtime
+#define MODEL_TABLES(Model) \
+    constexpr const char *Model::name; \
+    constexpr CourtDefinition Model::definition; \
+    constexpr CourtLineModel Model::lines[]; \
+    constexpr int Model::identified[]; \
+    constexpr CourtLinePair Model::keypoint_lines[]; \
+    constexpr int Model::transverse[]; \
+    constexpr int Model::longitudinal[];
+
+MODEL_TABLES(ITF)
+MODEL_TABLES(Padel)
+MODEL_TABLES(Badminton)
+MODEL_TABLES(Pickleball)
+
+#undef MODEL_TABLES
+
+static constexpr CourtModel court_models[] = {
+    court_model<ITF>(),
+    court_model<Padel>(),
+    court_model<Badminton>(),
+    court_model<Pickleball>(),
 };
 
-Court::Court(std::string rule_type)
+
+static const CourtModel& find_model(const std::string& rule_type)
 {
-    this->court_definition = court_definitions[rule_type];
+    for (const CourtModel& model : court_models)
+    {
+        if (std::strcmp(model.name, rule_type.c_str()) == 0)
+            return model;
+    }
+    throw std::invalid_argument("unknown rule type '" + rule_type + "'");
 }
 
-std::vector<cv::Point3f> Court::serveline()
+static cv::Point3f to_point(const CourtPoint& point)
 {
-    float width = this->court_definition.width;
-    float serveline_width = this->court_definition.serveline_width;
-    float y = this->court_definition.length/2-this->court_definition.serveline_offset;
-
-    std::vector<cv::Point3f> keypoints(2);
-    keypoints = {cv::Point3f((width-serveline_width)/2, y, 0),
-                 cv::Point3f((width+serveline_width)/2, y, 0)};
-    return keypoints;
+    return cv::Point3f(point.x, point.y, point.z);
 }
 
-std::vector<cv::Point3f> Court::baseline()
-{
-    float width = this->court_definition.width;
 
-    std::vector<cv::Point3f> keypoints(2);
-    keypoints = {cv::Point3f(0, 0, 0),
-                 cv::Point3f(width, 0, 0)};
-    return keypoints;
+Court::Court(std::string rule_type):
+    Court(find_model(rule_type))
+{}
+
+Court::Court(const CourtModel& model):
+    court_definition(model.definition)
+{
+    for (int l = 0; l < model.line_count; l++)
+    {
+        const CourtLineModel& line = model.lines[l];
+        this->names.push_back(line.name);
+        this->court_lines.push_back({to_point(line.segment.p1), to_point(line.segment.p2)});
+        if (line.painted)
+            this->painted.push_back(l);
+    }
+    this->identified.assign(model.identified, model.identified + model.identified_count);
+    for (int k = 0; k < model.keypoint_count; k++)
+    {
+        this->keypoint_pairs.push_back(std::make_pair(model.keypoint_lines[k].first, model.keypoint_lines[k].second));
+        this->court_keypoints.push_back(to_point(model.keypoints[k]));
+    }
+    this->court_rectangles.assign(model.rectangles, model.rectangles + model.rectangle_count);
 }
 
-std::vector<cv::Point3f> Court::netline()
+int Court::index(const std::string& name) const
 {
-    float width = this->court_definition.width;
-    float y = this->court_definition.length/2;
+    auto it = std::find(this->names.begin(), this->names.end(), name);
+    if (it == this->names.end())
+        throw std::invalid_argument("unknown court line '" + name + "'");
+    return it - this->names.begin();
+}
 
-    std::vector<cv::Point3f> keypoints(2);
-    keypoints = {cv::Point3f(0, y, 0),
-                 cv::Point3f(width, y, 0)};
-    return keypoints;
+const std::vector<std::vector<cv::Point3f>>& Court::lines() const
+{
+    return this->court_lines;
 }
 
-std::vector<cv::Point3f> Court::centerline()
+const std::vector<std::string>& Court::line_names() const
 {
-    float x = this->court_definition.width/2;
-    float mid = this->court_definition.length/2;
-    float offset = this->court_definition.serveline_offset;
-
-    std::vector<cv::Point3f> keypoints(2);
-    keypoints = {cv::Point3f(x, mid-offset, 0),
-                 cv::Point3f(x, mid+offset, 0)};
-    return keypoints;
+    return this->names;
 }
 
-std::vector<cv::Point3f> Court::left_sideline()
+const std::vector<cv::Point3f>& Court::line(const std::string& name) const
 {
-    float length = this->court_definition.length;
+    return this->court_lines[this->index(name)];
+}
 
-    std::vector<cv::Point3f> keypoints(2);
-    keypoints = {cv::Point3f(0, 0, 0),
-                 cv::Point3f(0, length, 0)};
-    return keypoints;
+const std::vector<int>& Court::painted_lines() const
+{
+    return this->painted;
 }
 
-std::vector<cv::Point3f> Court::right_sideline()
+const std::vector<int>& Court::identified_lines() const
 {
-    float width = this->court_definition.width;
-    float length = this->court_definition.length;
+    return this->identified;
+}
 
-    std::vector<cv::Point3f> keypoints(2);
-    keypoints = {cv::Point3f(width, 0, 0),
-                 cv::Point3f(width, length, 0)};
-    return keypoints;
+const std::vector<std::pair<int, int>>& Court::keypoint_lines() const
+{
+    return this->keypoint_pairs;
 }
 
-std::vector<cv::Point3f> Court::left_single_sideline()
+const std::vector<cv::Point3f>& Court::keypoints() const
 {
-    float x = (this->court_definition.width + this->court_definition.serveline_width)/2;
-    float length = this->court_definition.length;
+    return this->court_keypoints;
+}
 
-    std::vector<cv::Point3f> keypoints(2);
-    keypoints = {cv::Point3f(x, 0, 0),
-                 cv::Point3f(x, length, 0)};
-    return keypoints;
+const std::vector<CourtRectangle>& Court::rectangles() const
+{
+    return this->court_rectangles;
 }
 
-std::vector<cv::Point3f> Court::right_single_sideline()
+const CourtDefinition& Court::definition() const
 {
-    float x = (this->court_definition.width - this->court_definition.serveline_width)/2;
-    float length = this->court_definition.length;
+    return this->court_definition;
+}
 
-    std::vector<cv::Point3f> keypoints(2);
-    keypoints = {cv::Point3f(x, 0, 0),
-                 cv::Point3f(x, length, 0)};
-    return keypoints;
+std::vector<std::string> Court::rule_types()
+{
+    std::vector<std::string> rule_types;
+    for (const CourtModel& model : court_models)
+        rule_types.push_back(model.name);
+    return rule_types;
 }
@@ -1,20 +1,19 @@
 #pragma once
 
+#include <string>
+#include <vector>
+#include <utility>
 #include <opencv2/core/mat.hpp>
 
 /**
- * @brief Representation tennis court variable dimensions
- * @param length: length of the tennis court
- * @param width: width of the tennis court
- * @param serveline_width: width of the service line
- * @param serveline_offset: offset of the service line from the net
- * @param linewidth: tennis court lines width
+ * @brief Court dimensions
+ * @param length: length of the court
+ * @param width: width of the court
+ * @param linewidth: court lines width
  */
 typedef struct {
     float length;
     float width;
-    float serveline_width;
-    float serveline_offset;
     float linewidth;
 } CourtDefinition;
 
@@ -43,23 +42,526 @@ y-axis  |   |                   |   |
 */
 
 /**
- * @brief Representation of a tennis court
- * @param rule_type: string representing the tennis court rule type (and its
- * dimensions). Currently, only ITF is supported.
+ * @brief Court point in world coordinates (meters), usable in constant
+ * expressions.
+*/
+typedef struct {
+    float x;
+    float y;
+    float z;
+} CourtPoint;
+
+/**
+ * @brief Court line between two court points.
+*/
+typedef struct {
+    CourtPoint p1;
+    CourtPoint p2;
+} CourtSegment;
+
+/**
+ * @brief Line of a court model, on the ground plane (z=0).
+ * @param name: name of the line
+ * @param segment: extremities of the line
+ * @param painted: false for lines that aren't painted on the ground (e.g. the
+ * net), which are not searched for in the images.
+*/
+typedef struct {
+    const char *name;
+    CourtSegment segment;
+    bool painted;
+} CourtLineModel;
+
+/**
+ * @brief Two court lines, by index.
+*/
+typedef struct {
+    int first;
+    int second;
+} CourtLinePair;
+
+/**
+ * @brief Court rectangle between two transverse lines (y1 < y2) and two
+ * longitudinal lines (x1 < x2).
+*/
+typedef struct {
+    float x1;
+    float y1;
+    float x2;
+    float y2;
+} CourtRectangle;
+
+
+/**
+ * @brief Line of the ground plane from (x1, y1) to (x2, y2), for the line
+ * tables of the court models.
+*/
+constexpr CourtLineModel court_line(const char *name, float x1, float y1, float x2, float y2, bool painted=true)
+{
+    return CourtLineModel{name, {{x1, y1, 0}, {x2, y2, 0}}, painted};
+}
+
+
+/*
+Compile-time court models. A model is a type with the rule type `name`, the
+court `definition`, the table of its `lines` indexed by its CourtLine enum, and
+the roles of some of the lines in the detection, as arrays of CourtLine:
+- `identified`: painted lines identified in the image (see IdentifyLines) and
+  tracked, in the order given to ComputeHomography;
+- `keypoint_lines`: pairs of identified lines whose intersections are the
+  keypoints of the homography (at least 4);
+- `transverse`: lines parallel to the x-axis, by increasing y, used as the
+  closest and furthest lines of the identification hypotheses;
+- `longitudinal`: lines parallel to the y-axis, by increasing x, used as the
+  left and right lines of the identification hypotheses.
+CourtGeometry derives the keypoints and rectangles of a model at compile time
+and checks its roles; new models are added to the table of court.cpp to be
+found by name.
+*/
+
+/**
+ * @brief Tennis (ITF): the sidelines and the centerline cross the net. The
+ * keypoints are A to E of the court diagram.
+*/
+struct ITF
+{
+    enum CourtLine {
+        netline_index, baseline_index, serveline_index, centerline_index, left_sideline_index, right_sideline_index,
+        left_single_sideline_index, right_single_sideline_index, court_line_count
+    };
+    static constexpr const char *name = "ITF";
+    static constexpr CourtDefinition definition = {23.77f, 10.97f, 0.05f};
+    static constexpr float length = definition.length, width = definition.width;
+    static constexpr float single = (width - 8.23f)/2, serve = length/2 - 6.40f;
+    static constexpr CourtLineModel lines[court_line_count] = {
+        court_line("netline", 0, length/2, width, length/2, false),
+        court_line("baseline", 0, 0, width, 0),
+        court_line("serveline", single, serve, width - single, serve),
+        court_line("centerline", width/2, serve, width/2, length - serve),
+        court_line("left_sideline", 0, 0, 0, length),
+        court_line("right_sideline", width, 0, width, length),
+        court_line("left_single_sideline", single, 0, single, length),
+        court_line("right_single_sideline", width - single, 0, width - single, length),
+    };
+    static constexpr int identified[] = {
+        serveline_index, baseline_index, left_single_sideline_index, right_single_sideline_index, centerline_index
+    };
+    static constexpr CourtLinePair keypoint_lines[] = {
+        {serveline_index, left_single_sideline_index}, {serveline_index, right_single_sideline_index},
+        {baseline_index, left_single_sideline_index}, {baseline_index, right_single_sideline_index},
+        {serveline_index, centerline_index},
+    };
+    static constexpr int transverse[] = {baseline_index, serveline_index};
+    static constexpr int longitudinal[] = {
+        left_sideline_index, left_single_sideline_index, centerline_index, right_single_sideline_index,
+        right_sideline_index
+    };
+};
+
+/**
+ * @brief Padel: the court is enclosed by walls, whose bottom edges are taken
+ * as the baselines and sidelines. The centerline extends 0.20 m beyond the
+ * servelines.
+*/
+struct Padel
+{
+    enum CourtLine {
+        netline_index, baseline_index, serveline_index, centerline_index, left_sideline_index, right_sideline_index,
+        far_serveline_index, far_baseline_index, court_line_count
+    };
+    static constexpr const char *name = "padel";
+    static constexpr CourtDefinition definition = {20, 10, 0.05f};
+    static constexpr CourtLineModel lines[court_line_count] = {
+        court_line("netline", 0, 10, 10, 10, false),
+        court_line("baseline", 0, 0, 10, 0),
+        court_line("serveline", 0, 3.05f, 10, 3.05f),
+        court_line("centerline", 5, 2.85f, 5, 17.15f),
+        court_line("left_sideline", 0, 0, 0, 20),
+        court_line("right_sideline", 10, 0, 10, 20),
+        court_line("far_serveline", 0, 16.95f, 10, 16.95f),
+        court_line("far_baseline", 0, 20, 10, 20),
+    };
+    static constexpr int identified[] = {
+        serveline_index, baseline_index, left_sideline_index, right_sideline_index, centerline_index
+    };
+    static constexpr CourtLinePair keypoint_lines[] = {
+        {serveline_index, left_sideline_index}, {serveline_index, right_sideline_index},
+        {baseline_index, left_sideline_index}, {baseline_index, right_sideline_index},
+        {serveline_index, centerline_index},
+    };
+    static constexpr int transverse[] = {baseline_index, serveline_index};
+    static constexpr int longitudinal[] = {left_sideline_index, centerline_index, right_sideline_index};
+};
+
+/**
+ * @brief Badminton: the long serviceline is the one of doubles.
+*/
+struct Badminton
+{
+    enum CourtLine {
+        netline_index, baseline_index, long_serviceline_index, short_serviceline_index, centerline_index,
+        left_sideline_index, right_sideline_index, left_single_sideline_index, right_single_sideline_index,
+        far_short_serviceline_index, far_long_serviceline_index, far_baseline_index, far_centerline_index,
+        court_line_count
+    };
+    static constexpr const char *name = "badminton";
+    static constexpr CourtDefinition definition = {13.40f, 6.10f, 0.04f};
+    static constexpr CourtLineModel lines[court_line_count] = {
+        court_line("netline", 0, 6.70f, 6.10f, 6.70f, false),
+        court_line("baseline", 0, 0, 6.10f, 0),
+        court_line("long_serviceline", 0, 0.76f, 6.10f, 0.76f),
+        court_line("short_serviceline", 0, 4.72f, 6.10f, 4.72f),
+        court_line("centerline", 3.05f, 0, 3.05f, 4.72f),
+        court_line("left_sideline", 0, 0, 0, 13.40f),
+        court_line("right_sideline", 6.10f, 0, 6.10f, 13.40f),
+        court_line("left_single_sideline", 0.46f, 0, 0.46f, 13.40f),
+        court_line("right_single_sideline", 5.64f, 0, 5.64f, 13.40f),
+        court_line("far_short_serviceline", 0, 8.68f, 6.10f, 8.68f),
+        court_line("far_long_serviceline", 0, 12.64f, 6.10f, 12.64f),
+        court_line("far_baseline", 0, 13.40f, 6.10f, 13.40f),
+        court_line("far_centerline", 3.05f, 8.68f, 3.05f, 13.40f),
+    };
+    static constexpr int identified[] = {
+        short_serviceline_index, baseline_index, left_single_sideline_index, right_single_sideline_index,
+        centerline_index
+    };
+    static constexpr CourtLinePair keypoint_lines[] = {
+        {short_serviceline_index, left_single_sideline_index}, {short_serviceline_index, right_single_sideline_index},
+        {baseline_index, left_single_sideline_index}, {baseline_index, right_single_sideline_index},
+        {short_serviceline_index, centerline_index}, {baseline_index, centerline_index},
+    };
+    static constexpr int transverse[] = {baseline_index, long_serviceline_index, short_serviceline_index};
+    static constexpr int longitudinal[] = {
+        left_sideline_index, left_single_sideline_index, centerline_index, right_single_sideline_index,
+        right_sideline_index
+    };
+};
+
+/**
+ * @brief Pickleball: the nonvolley lines are 2.13 m (7 ft) from the net.
+*/
+struct Pickleball
+{
+    enum CourtLine {
+        netline_index, baseline_index, nonvolley_line_index, centerline_index, left_sideline_index,
+        right_sideline_index, far_nonvolley_line_index, far_baseline_index, far_centerline_index, court_line_count
+    };
+    static constexpr const char *name = "pickleball";
+    static constexpr CourtDefinition definition = {13.41f, 6.10f, 0.05f};
+    static constexpr CourtLineModel lines[court_line_count] = {
+        court_line("netline", 0, 6.705f, 6.10f, 6.705f, false),
+        court_line("baseline", 0, 0, 6.10f, 0),
+        court_line("nonvolley_line", 0, 4.575f, 6.10f, 4.575f),
+        court_line("centerline", 3.05f, 0, 3.05f, 4.575f),
+        court_line("left_sideline", 0, 0, 0, 13.41f),
+        court_line("right_sideline", 6.10f, 0, 6.10f, 13.41f),
+        court_line("far_nonvolley_line", 0, 8.835f, 6.10f, 8.835f),
+        court_line("far_baseline", 0, 13.41f, 6.10f, 13.41f),
+        court_line("far_centerline", 3.05f, 8.835f, 3.05f, 13.41f),
+    };
+    static constexpr int identified[] = {
+        nonvolley_line_index, baseline_index, left_sideline_index, right_sideline_index, centerline_index
+    };
+    static constexpr CourtLinePair keypoint_lines[] = {
+        {nonvolley_line_index, left_sideline_index}, {nonvolley_line_index, right_sideline_index},
+        {baseline_index, left_sideline_index}, {baseline_index, right_sideline_index},
+        {nonvolley_line_index, centerline_index}, {baseline_index, centerline_index},
+    };
+    static constexpr int transverse[] = {baseline_index, nonvolley_line_index};
+    static constexpr int longitudinal[] = {left_sideline_index, centerline_index, right_sideline_index};
+};
+
+
+/**
+ * @brief Fixed-size table computed at compile time.
+*/
+template<typename T, int N>
+struct CourtTable
+{
+    T items[N];
+};
+
+template<int... I>
+struct court_indices {};
+
+template<int N, int... I>
+struct make_court_indices: make_court_indices<N - 1, N - 1, I...> {};
+
+template<int... I>
+struct make_court_indices<0, I...>
+{
+    typedef court_indices<I...> type;
+};
+
+/**
+ * @return the determinant of the directions of two segments, zero if they are
+ * parallel.
+*/
+constexpr double court_determinant(const CourtSegment& a, const CourtSegment& b)
+{
+    return (double)(a.p2.x - a.p1.x)*(b.p2.y - b.p1.y) - (double)(a.p2.y - a.p1.y)*(b.p2.x - b.p1.x);
+}
+
+/**
+ * @return the point at `t` times the direction of `segment` from its first
+ * extremity.
+*/
+constexpr CourtPoint court_point(const CourtSegment& segment, double t)
+{
+    return CourtPoint{(float)(segment.p1.x + t*(segment.p2.x - segment.p1.x)),
+                      (float)(segment.p1.y + t*(segment.p2.y - segment.p1.y)), 0};
+}
+
+/**
+ * @return the intersection of the lines through two non-parallel segments.
+*/
+constexpr CourtPoint court_intersection(const CourtSegment& a, const CourtSegment& b)
+{
+    return court_point(a, ((double)(b.p1.x - a.p1.x)*(b.p2.y - b.p1.y) - (double)(b.p1.y - a.p1.y)*(b.p2.x - b.p1.x))/
+                          court_determinant(a, b));
+}
+
+/**
+ * @return the position of `line` in `lines`, or `count` if it isn't there.
+*/
+constexpr int court_line_position(const int *lines, int count, int line, int i=0)
+{
+    return i == count || lines[i] == line ? i : court_line_position(lines, count, line, i + 1);
+}
+
+/**
+ * @return the number of pairs of `n` items.
+*/
+constexpr int court_pair_count(int n)
+{
+    return n*(n - 1)/2;
+}
+
+/**
+ * @return the `p`-th pair (i, j), i < j, of `n` items in lexicographic order.
+*/
+constexpr int court_pair_first(int n, int p, int i=0)
+{
+    return p < n - 1 - i ? i : court_pair_first(n, p - (n - 1 - i), i + 1);
+}
+
+constexpr int court_pair_second(int n, int p, int i=0)
+{
+    return p < n - 1 - i ? i + 1 + p : court_pair_second(n, p - (n - 1 - i), i + 1);
+}
+
+constexpr bool painted_court_lines(const CourtLineModel *lines, const int *indices, int count)
+{
+    return count == 0 || (lines[indices[0]].painted && painted_court_lines(lines, indices + 1, count - 1));
+}
+
+constexpr bool valid_keypoint_lines(const CourtLineModel *lines, const int *identified, int identified_count,
+                                    const CourtLinePair *pairs, int count)
+{
+    return count == 0 || (court_line_position(identified, identified_count, pairs[0].first) < identified_count &&
+                          court_line_position(identified, identified_count, pairs[0].second) < identified_count &&
+                          court_determinant(lines[pairs[0].first].segment, lines[pairs[0].second].segment) != 0 &&
+                          valid_keypoint_lines(lines, identified, identified_count, pairs + 1, count - 1));
+}
+
+constexpr bool sorted_transverse_lines(const CourtLineModel *lines, const int *indices, int count)
+{
+    return count == 0 || (lines[indices[0]].segment.p1.y == lines[indices[0]].segment.p2.y &&
+                          (count == 1 || lines[indices[0]].segment.p1.y < lines[indices[1]].segment.p1.y) &&
+                          sorted_transverse_lines(lines, indices + 1, count - 1));
+}
+
+constexpr bool sorted_longitudinal_lines(const CourtLineModel *lines, const int *indices, int count)
+{
+    return count == 0 || (lines[indices[0]].segment.p1.x == lines[indices[0]].segment.p2.x &&
+                          (count == 1 || lines[indices[0]].segment.p1.x < lines[indices[1]].segment.p1.x) &&
+                          sorted_longitudinal_lines(lines, indices + 1, count - 1));
+}
+
+template<typename Model, int... I>
+constexpr CourtTable<CourtLinePair, sizeof...(I)> make_keypoint_positions(court_indices<I...>)
+{
+    return {{CourtLinePair{
+        court_line_position(Model::identified, sizeof(Model::identified)/sizeof(int), Model::keypoint_lines[I].first),
+        court_line_position(Model::identified, sizeof(Model::identified)/sizeof(int), Model::keypoint_lines[I].second)
+    }...}};
+}
+
+template<typename Model, int... I>
+constexpr CourtTable<CourtPoint, sizeof...(I)> make_keypoints(court_indices<I...>)
+{
+    return {{court_intersection(Model::lines[Model::keypoint_lines[I].first].segment,
+                                Model::lines[Model::keypoint_lines[I].second].segment)...}};
+}
+
+/**
+ * @return the rectangle of the `t`-th pair of transverse lines and the `l`-th
+ * pair of longitudinal lines.
+*/
+template<typename Model>
+constexpr CourtRectangle make_rectangle(int t, int l, int transverse_count, int longitudinal_count)
+{
+    return CourtRectangle{
+        Model::lines[Model::longitudinal[court_pair_first(longitudinal_count, l)]].segment.p1.x,
+        Model::lines[Model::transverse[court_pair_first(transverse_count, t)]].segment.p1.y,
+        Model::lines[Model::longitudinal[court_pair_second(longitudinal_count, l)]].segment.p1.x,
+        Model::lines[Model::transverse[court_pair_second(transverse_count, t)]].segment.p1.y,
+    };
+}
+
+/**
+ * @return every pair of transverse lines with every pair of longitudinal
+ * lines, the latter varying fastest.
+*/
+template<typename Model, int... I>
+constexpr CourtTable<CourtRectangle, sizeof...(I)> make_rectangles(int transverse_count, int longitudinal_count, court_indices<I...>)
+{
+    return {{make_rectangle<Model>(I/court_pair_count(longitudinal_count), I%court_pair_count(longitudinal_count),
+                                   transverse_count, longitudinal_count)...}};
+}
+
+
+/**
+ * @brief Precomputed geometry of a court model: the keypoints (intersections
+ * of the keypoint lines) and their lines by position in the identified lines,
+ * and the rectangles of the identification hypotheses. The roles of the model
+ * lines are checked at compile time.
+*/
+template<typename Model>
+struct CourtGeometry
+{
+    static constexpr int line_count = sizeof(Model::lines)/sizeof(Model::lines[0]);
+    static constexpr int identified_count = sizeof(Model::identified)/sizeof(int);
+    static constexpr int keypoint_count = sizeof(Model::keypoint_lines)/sizeof(Model::keypoint_lines[0]);
+    static constexpr int transverse_count = sizeof(Model::transverse)/sizeof(int);
+    static constexpr int longitudinal_count = sizeof(Model::longitudinal)/sizeof(int);
+    static constexpr int rectangle_count = court_pair_count(transverse_count)*court_pair_count(longitudinal_count);
+
+    static_assert(painted_court_lines(Model::lines, Model::identified, identified_count),
+                  "identified lines must be painted");
+    static_assert(keypoint_count >= 4, "court models need at least 4 keypoints");
+    static_assert(valid_keypoint_lines(Model::lines, Model::identified, identified_count, Model::keypoint_lines, keypoint_count),
+                  "keypoint lines must be identified and not parallel");
+    static_assert(transverse_count >= 2 && sorted_transverse_lines(Model::lines, Model::transverse, transverse_count),
+                  "transverse lines must be parallel to the x-axis, by increasing y");
+    static_assert(longitudinal_count >= 2 && sorted_longitudinal_lines(Model::lines, Model::longitudinal, longitudinal_count),
+                  "longitudinal lines must be parallel to the y-axis, by increasing x");
+
+    static constexpr CourtTable<CourtLinePair, keypoint_count> keypoint_positions =
+        make_keypoint_positions<Model>(typename make_court_indices<keypoint_count>::type());
+    static constexpr CourtTable<CourtPoint, keypoint_count> keypoints =
+        make_keypoints<Model>(typename make_court_indices<keypoint_count>::type());
+    static constexpr CourtTable<CourtRectangle, rectangle_count> rectangles =
+        make_rectangles<Model>(transverse_count, longitudinal_count, typename make_court_indices<rectangle_count>::type());
+};
+
+template<typename Model>
+constexpr CourtTable<CourtLinePair, CourtGeometry<Model>::keypoint_count> CourtGeometry<Model>::keypoint_positions;
+template<typename Model>
+constexpr CourtTable<CourtPoint, CourtGeometry<Model>::keypoint_count> CourtGeometry<Model>::keypoints;
+template<typename Model>
+constexpr CourtTable<CourtRectangle, CourtGeometry<Model>::rectangle_count> CourtGeometry<Model>::rectangles;
+
+
+/**
+ * @brief Tables of a court model as read by Court, built from a model type
+ * with court_model.
+ * @param keypoint_lines: for each keypoint, the positions in `identified` of
+ * the two lines intersecting at it.
+*/
+typedef struct {
+    const char *name;
+    CourtDefinition definition;
+    const CourtLineModel *lines;
+    int line_count;
+    const int *identified;
+    int identified_count;
+    const CourtLinePair *keypoint_lines;
+    const CourtPoint *keypoints;
+    int keypoint_count;
+    const CourtRectangle *rectangles;
+    int rectangle_count;
+} CourtModel;
+
+template<typename Model>
+constexpr CourtModel court_model()
+{
+    typedef CourtGeometry<Model> Geometry;
+    return CourtModel{
+        Model::name, Model::definition, Model::lines, Geometry::line_count, Model::identified, Geometry::identified_count,
+        Geometry::keypoint_positions.items, Geometry::keypoints.items, Geometry::keypoint_count,
+        Geometry::rectangles.items, Geometry::rectangle_count,
+    };
+}
+
+
+/**
+ * @brief Representation of a court, copied from the precomputed tables of a
+ * court model once at construction; the accessors return references to them.
+ * @param rule_type: string representing the court rule type (and its
+ * dimensions), looked up once in the table of court models: "ITF" (tennis),
+ * "padel", "badminton" or "pickleball".
  */
 class Court
 {
     public:
         Court(std::string rule_type);
-        std::vector<cv::Point3f> netline();
-        std::vector<cv::Point3f> baseline();
-        std::vector<cv::Point3f> serveline();
-        std::vector<cv::Point3f> centerline();
-        std::vector<cv::Point3f> left_sideline();
-        std::vector<cv::Point3f> right_sideline();
-        std::vector<cv::Point3f> left_single_sideline();
-        std::vector<cv::Point3f> right_single_sideline();
+        /**
+         * @brief Court of a model type, e.g. Court(court_model<ITF>()).
+        */
+        Court(const CourtModel& model);
+        /**
+         * @return the extremities of every court line, in the model order.
+        */
+        const std::vector<std::vector<cv::Point3f>>& lines() const;
+        /**
+         * @return the name of every court line, in the model order.
+        */
+        const std::vector<std::string>& line_names() const;
+        /**
+         * @return the extremities of the court line `name`.
+         * @throws std::invalid_argument if the court has no such line.
+        */
+        const std::vector<cv::Point3f>& line(const std::string& name) const;
+        /**
+         * @return the indices of the painted lines.
+        */
+        const std::vector<int>& painted_lines() const;
+        /**
+         * @return the indices of the identified lines, in the order given to
+         * ComputeHomography.
+        */
+        const std::vector<int>& identified_lines() const;
+        /**
+         * @return for each keypoint, the positions in identified_lines() of the
+         * two lines intersecting at it.
+        */
+        const std::vector<std::pair<int, int>>& keypoint_lines() const;
+        /**
+         * @return the keypoints, intersections of the keypoint_lines().
+        */
+        const std::vector<cv::Point3f>& keypoints() const;
+        /**
+         * @return the rectangles of every pair of transverse lines with every
+         * pair of longitudinal lines.
+        */
+        const std::vector<CourtRectangle>& rectangles() const;
+        /**
+         * @return the court dimensions.
+        */
+        const CourtDefinition& definition() const;
+        /**
+         * @return the rule types of the court models.
+        */
+        static std::vector<std::string> rule_types();
     private:
+        int index(const std::string& name) const;
         CourtDefinition court_definition;
+        std::vector<std::vector<cv::Point3f>> court_lines;
+        std::vector<std::string> names;
+        std::vector<int> painted;
+        std::vector<int> identified;
+        std::vector<std::pair<int, int>> keypoint_pairs;
+        std::vector<cv::Point3f> court_keypoints;
+        std::vector<CourtRectangle> court_rectangles;
 };
-
@@ -0,0 +1,183 @@
+#include <cstdio>
+#include <algorithm>
+#include <opencv2/imgproc.hpp>
+
+#include "debuglayer.hpp"
+
+
+DebugLayer::DebugLayer(std::string name):
+    layer_name(name), offset(0, 0), scale(1), mask_count(0)
+{}
+
+
+void DebugLayer::reset(const std::string& name, cv::Point2f offset, float scale)
+{
+    this->layer_name = name;
+    this->offset = offset;
+    this->scale = scale;
+    this->layer_commands.clear();
+    this->labels.clear();
+    this->mask_count = 0;
+}
+
+
+cv::Point2f DebugLayer::map(cv::Point2f point) const
+{
+    return (point + this->offset)*this->scale;
+}
+
+
+void DebugLayer::line(const LineSegment& line, cv::Scalar color, int thickness, int markersize, const std::string& label)
+{
+    DebugCommand command;
+    command.shape = segment_shape;
+    command.p1 = this->map(cv::Point2f(line.x1, line.y1));
+    command.p2 = this->map(cv::Point2f(line.x2, line.y2));
+    command.color = color;
+    command.thickness = thickness;
+    command.size = markersize;
+    command.text = this->labels.size();
+    command.length = label.size();
+    this->labels += label;
+    this->layer_commands.push_back(command);
+}
+
+
+void DebugLayer::numbered_line(const LineSegment& line, int number, cv::Scalar color, int thickness, int markersize)
+{
+    DebugCommand command;
+    command.shape = numbered_segment_shape;
+    command.p1 = this->map(cv::Point2f(line.x1, line.y1));
+    command.p2 = this->map(cv::Point2f(line.x2, line.y2));
+    command.color = color;
+    command.thickness = thickness;
+    command.size = markersize;
+    command.text = 0;
+    command.length = 0;
+    command.number = number;
+    command.rho = line.rho;
+    command.theta = line.theta;
+    this->layer_commands.push_back(command);
+}
+
+
+void DebugLayer::projected_line(const Calib& calib, cv::Point3f p1, cv::Point3f p2, cv::Scalar color, int thickness, int markersize, const std::string& label)
+{
+    float x[2] = {p1.x, p2.x}, y[2] = {p1.y, p2.y}, z[2] = {p1.z, p2.z}, u[2], v[2];
+    calib.project(x, y, z, 2, u, v);
+    this->line(LineSegment(u[0], v[0], u[1], v[1]), color, thickness, markersize, label);
+}
+
+
+void DebugLayer::point(cv::Point2f center, int radius, cv::Scalar color, int thickness)
+{
+    DebugCommand command;
+    command.shape = point_shape;
+    command.p1 = this->map(center);
+    command.color = color;
+    command.thickness = thickness;
+    command.size = radius;
+    command.text = 0;
+    command.length = 0;
+    this->layer_commands.push_back(command);
+}
+
+
+void DebugLayer::text(cv::Point2f origin, const std::string& text, cv::Scalar color, int thickness)
+{
+    DebugCommand command;
+    command.shape = text_shape;
+    command.p1 = this->map(origin);
+    command.color = color;
+    command.thickness = thickness;
+    command.text = this->labels.size();
+    command.length = text.size();
+    this->labels += text;
+    this->layer_commands.push_back(command);
+}
+
+
+void DebugLayer::mask(const cv::Mat& mask, cv::Scalar color, int factor)
+{
+    if (this->mask_count == this->masks.size())
+        this->masks.push_back(cv::Mat());
+    cv::Mat& reduced = this->masks[this->mask_count];
+    reduced.create((mask.rows + factor - 1)/factor, (mask.cols + factor - 1)/factor, CV_8UC1);
+    reduced.setTo(0);
+    for (int y = 0; y < mask.rows; y++)
+    {
+        const uchar *pixels = mask.ptr<uchar>(y);
+        uchar *block = reduced.ptr<uchar>(y/factor);
+        for (int x = 0; x < mask.cols; block++)
+        {
+            for (int end = std::min(x + factor, mask.cols); x < end; x++)
+                *block |= pixels[x];
+        }
+    }
+
+    DebugCommand command;
+    command.shape = mask_shape;
+    command.color = color;
+    command.text = 0;
+    command.length = 0;
+    command.mask = this->mask_count++;
+    cv::Point2f origin = this->map(cv::Point2f(0, 0));
+    // The reduced image covers whole blocks, which may extend past the image
+    command.area = cv::Rect(cvRound(origin.x), cvRound(origin.y), cvRound(reduced.cols*factor*this->scale), cvRound(reduced.rows*factor*this->scale));
+    this->layer_commands.push_back(command);
+}
+
+
+void DebugLayer::render(cv::Mat& canvas) const
+{
+    for (const DebugCommand& command : this->layer_commands)
+    {
+        std::string label = this->labels.substr(command.text, command.length);
+        switch (command.shape)
+        {
+            case segment_shape:
+                draw_line(LineSegment(command.p1.x, command.p1.y, command.p2.x, command.p2.y), canvas, command.color, command.thickness, command.size, label);
+                break;
+            case numbered_segment_shape:
+            {
+                char number[48];
+                snprintf(number, sizeof(number), "%d |%d| %d", command.number, (int)command.rho, (int)(command.theta*180/CV_PI));
+                draw_line(LineSegment(command.p1.x, command.p1.y, command.p2.x, command.p2.y), canvas, command.color, command.thickness, command.size, number);
+                break;
+            }
+            case point_shape:
+                cv::circle(canvas, command.p1, command.size, command.color, command.thickness);
+                break;
+            case text_shape:
+                cv::putText(canvas, label, command.p1, cv::FONT_HERSHEY_SIMPLEX, 1, command.color, command.thickness);
+                break;
+            case mask_shape:
+            {
+                // Masks recorded on a downscaled image are upscaled without
+                // interpolation, and clipped to the canvas
+                cv::Rect area = command.area & cv::Rect(0, 0, canvas.cols, canvas.rows);
+                if (area.empty())
+                    break;
+                cv::Mat mask;
+                if (this->masks[command.mask].size() == command.area.size())
+                    mask = this->masks[command.mask];
+                else
+                    cv::resize(this->masks[command.mask], mask, command.area.size(), 0, 0, cv::INTER_NEAREST);
+                canvas(area).setTo(command.color, mask(area - command.area.tl()));
+                break;
+            }
+        }
+    }
+}
+
+
+const std::string& DebugLayer::name() const
+{
+    return this->layer_name;
+}
+
+
+const std::vector<DebugCommand>& DebugLayer::commands() const
+{
+    return this->layer_commands;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <opencv2/core/mat.hpp>
+
+#include "utils.hpp"
+
+
+enum DebugShape { segment_shape, numbered_segment_shape, point_shape, text_shape, mask_shape };
+
+
+/**
+ * @brief Draw command of a debug layer, in image coordinates
+ * @param shape: kind of drawing
+ * @param p1: segment extremity, point center or text origin
+ * @param p2: other segment extremity
+ * @param color: color of the drawing (RGB)
+ * @param thickness: thickness of the strokes (-1 fills the points)
+ * @param size: size of the segment markers, or radius of the point
+ * @param text: offset of the label in the layer text buffer
+ * @param length: length of the label (0 if none)
+ * @param number, rho, theta: label of the numbered segments, formatted when
+ * rendered (see DebugLayer::numbered_line)
+ * @param mask: index of the mask in the layer, and area it covers (see
+ * DebugLayer::mask)
+*/
+typedef struct {
+    DebugShape shape;
+    cv::Point2f p1, p2;
+    cv::Scalar color;
+    int thickness;
+    int size;
+    size_t text;
+    size_t length;
+    int number;
+    float rho, theta;
+    size_t mask;
+    cv::Rect area;
+} DebugCommand;
+
+
+/**
+ * @brief Visualization of an operation, recorded as a list of draw commands
+ * (segments, points, labels and masks) instead of being drawn on an image. A
+ * layer is cheap to record and is only rasterized when rendered (see render),
+ * possibly in another thread (see AsyncDebugSink). Clearing a layer keeps the
+ * capacity of its buffers, so that recording the same operation on
+ * consecutive images doesn't allocate once the buffers have grown.
+ *
+ * Operations that work on a region or a downscaled version of the image
+ * record in their own coordinates: the coordinates are mapped to the image
+ * with the transform set by reset (`(p + offset)*scale`).
+ * @param name: name of the layer, e.g. the operation
+*/
+class DebugLayer
+{
+    public:
+        DebugLayer(std::string name="");
+        /**
+         * @brief Removes the commands, keeping the buffers capacity.
+         * @param name: new name of the layer
+         * @param offset: offset added to the recorded coordinates
+         * @param scale: scale applied to the recorded coordinates after the
+         * offset
+        */
+        void reset(const std::string& name, cv::Point2f offset=cv::Point2f(0, 0), float scale=1);
+        /**
+         * @brief Records a segment with markers at its extremities and a label
+         * at its middle (see draw_line).
+        */
+        void line(const LineSegment& line, cv::Scalar color, int thickness=2, int markersize=5, const std::string& label="");
+        /**
+         * @brief Records a segment labeled with `number` and its polar
+         * coordinates (`number |rho| theta`, theta in degrees). The label is
+         * only formatted when rendered, so that recording doesn't allocate.
+        */
+        void numbered_line(const LineSegment& line, int number, cv::Scalar color, int thickness=2, int markersize=5);
+        /**
+         * @brief Records a segment given the 3D coordinates of its extremities,
+         * projected with `calib`.
+        */
+        void projected_line(const Calib& calib, cv::Point3f p1, cv::Point3f p2, cv::Scalar color, int thickness=2, int markersize=5, const std::string& label="");
+        /**
+         * @brief Records a circle, filled if `thickness` is negative.
+        */
+        void point(cv::Point2f center, int radius, cv::Scalar color, int thickness=-1);
+        /**
+         * @brief Records a label, `origin` being its bottom-left corner.
+        */
+        void text(cv::Point2f origin, const std::string& text, cv::Scalar color, int thickness=2);
+        /**
+         * @brief Records a binary image whose non-zero pixels are painted with
+         * `color`. The image is copied in a buffer of the layer, reduced by
+         * `factor` in each dimension: a pixel of the copy is set if any pixel
+         * of its block is, which keeps thin lines visible.
+        */
+        void mask(const cv::Mat& mask, cv::Scalar color, int factor=2);
+        /**
+         * @brief Draws the commands on `canvas` (an RGB image of the size of
+         * the mapped coordinates).
+        */
+        void render(cv::Mat& canvas) const;
+        const std::string& name() const;
+        const std::vector<DebugCommand>& commands() const;
+    private:
+        cv::Point2f map(cv::Point2f point) const;
+        std::string layer_name;
+        cv::Point2f offset;
+        float scale;
+        std::vector<DebugCommand> layer_commands;
+        std::string labels;
+        std::vector<cv::Mat> masks;
+        size_t mask_count;
+};
@@ -0,0 +1,152 @@
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "debugsink.hpp"
+
+
+AsyncDebugSink::AsyncDebugSink(std::string path, DebugOutput output, std::vector<std::string> layers, int depth, double fps):
+    path(path), output(output), layers(layers), fps(fps), free_slots(depth), queued_slots(depth),
+    submitted_count(0), dropped_count(0), failed(false), stop(false)
+{
+    for (int i = 0; i < depth; i++)
+    {
+        Slot slot;
+        slot.count = 0;
+        this->free_slots.try_push(slot);
+    }
+    this->thread = std::thread(&AsyncDebugSink::run, this);
+}
+
+
+AsyncDebugSink::~AsyncDebugSink()
+{
+    try
+    {
+        this->close();
+    }
+    catch (std::exception& e) {} // destructors can't report the error
+}
+
+
+void AsyncDebugSink::close()
+{
+    if (this->thread.joinable())
+    {
+        this->stop = true;
+        this->thread.join();
+    }
+    if (this->error)
+    {
+        std::rethrow_exception(this->error);
+    }
+}
+
+
+bool AsyncDebugSink::submit(const cv::Mat& image, std::vector<DebugLayer>& layers, size_t count)
+{
+    uint32_t index = this->submitted_count++;
+    Slot slot;
+    if (this->failed || this->stop || !this->free_slots.try_pop(slot))
+    {
+        this->dropped_count++;
+        return false;
+    }
+    slot.index = index;
+    image.copyTo(slot.image);
+    std::swap(slot.layers, layers);
+    slot.count = count;
+    // There are as many slots as room in the queue
+    this->queued_slots.try_push(slot);
+    return true;
+}
+
+
+size_t AsyncDebugSink::submitted() const
+{
+    return this->submitted_count;
+}
+
+
+size_t AsyncDebugSink::dropped() const
+{
+    return this->dropped_count;
+}
+
+
+void AsyncDebugSink::run()
+{
+    Slot slot;
+    while (true)
+    {
+        // Images submitted before the stop request are still rendered
+        bool stopping = this->stop;
+        while (this->queued_slots.try_pop(slot))
+        {
+            if (!this->failed)
+            {
+                try
+                {
+                    this->render(slot);
+                }
+                catch (...)
+                {
+                    this->error = std::current_exception();
+                    this->failed = true;
+                }
+            }
+            this->free_slots.try_push(slot);
+        }
+        if (stopping)
+            return;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+
+void AsyncDebugSink::render(Slot& slot)
+{
+    auto selected = [this](const DebugLayer& layer) {
+        return this->layers.empty() || std::find(this->layers.begin(), this->layers.end(), layer.name()) != this->layers.end();
+    };
+
+    if (this->output == video_output)
+    {
+        cv::cvtColor(slot.image, this->canvas, cv::COLOR_GRAY2RGB);
+        for (size_t i = 0; i < slot.count; i++)
+        {
+            if (selected(slot.layers[i]))
+                slot.layers[i].render(this->canvas);
+        }
+        if (!this->writer.isOpened())
+        {
+            bool avi = this->path.size() >= 4 && this->path.compare(this->path.size() - 4, 4, ".avi") == 0;
+            int fourcc = avi ? cv::VideoWriter::fourcc('M', 'J', 'P', 'G') : cv::VideoWriter::fourcc('m', 'p', '4', 'v');
+            if (!this->writer.open(this->path, fourcc, this->fps, this->canvas.size(), true))
+            {
+                throw std::runtime_error("could not open '" + this->path + "'");
+            }
+        }
+        this->writer.write(this->canvas);
+        return;
+    }
+
+    for (size_t i = 0; i < slot.count; i++)
+    {
+        const DebugLayer& layer = slot.layers[i];
+        if (!selected(layer))
+            continue;
+        cv::cvtColor(slot.image, this->canvas, cv::COLOR_GRAY2RGB);
+        layer.render(this->canvas);
+        std::ostringstream filename;
+        filename << this->path << "/" << std::setw(6) << std::setfill('0') << slot.index << "_" << i << "_" << layer.name() << ".png";
+        if (!cv::imwrite(filename.str(), this->canvas))
+        {
+            throw std::runtime_error("could not write '" + filename.str() + "'");
+        }
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <exception>
+#include <opencv2/core/mat.hpp>
+#include <opencv2/videoio.hpp>
+
+#include "debuglayer.hpp"
+#include "spscqueue.hpp"
+
+
+enum DebugOutput { png_output, video_output };
+
+
+/**
+ * @brief Renders the debug layers of consecutive images in a background
+ * thread, so that a module can stay in debug mode on a live stream: submitting
+ * an image only copies it with its layers, the layers being rasterized over
+ * the image and written to files by the sink thread.
+ *
+ * The images and their layers are kept in a fixed number of slots passed
+ * between the submitting thread and the sink thread through lock-free queues.
+ * When the sink thread falls behind and no slot is free, the submitted image
+ * is dropped instead of waiting (see dropped). Once the slots buffers have
+ * grown, submitting doesn't allocate memory. Errors raised while rendering
+ * don't interrupt the submitting thread: the following images are dropped and
+ * the error is rethrown by close.
+ * @param path: with `png_output`, directory in which each layer is written to
+ * `<image index>_<layer index>_<layer name>.png`. With `video_output`, video
+ * file in which the layers of each image are drawn on one frame.
+ * @param output: `png_output` or `video_output`
+ * @param layers: names of the layers rendered, all if empty.
+ * @param depth: number of images waiting to be rendered before images are
+ * dropped.
+ * @param fps: frame rate of the video
+*/
+class AsyncDebugSink
+{
+    public:
+        AsyncDebugSink(std::string path, DebugOutput output=png_output, std::vector<std::string> layers={}, int depth=4, double fps=25);
+        /**
+         * @brief Renders the images still waiting and stops the sink thread
+         * (see close).
+        */
+        ~AsyncDebugSink();
+        AsyncDebugSink(const AsyncDebugSink&) = delete;
+        AsyncDebugSink& operator=(const AsyncDebugSink&) = delete;
+        /**
+         * @brief Submits an image and the first `count` layers of `layers`,
+         * which are exchanged with the layers of a free slot (whose content is
+         * stale: they must be reset before recording). Must always be called
+         * from the same thread.
+         * @param image: gray image on which the layers are rendered, copied.
+         * @return false if the image was dropped.
+        */
+        bool submit(const cv::Mat& image, std::vector<DebugLayer>& layers, size_t count);
+        /**
+         * @brief Renders the images still waiting and stops the sink thread.
+         * Images submitted afterwards are dropped.
+         * @throws the error raised while rendering an image, if any.
+        */
+        void close();
+        /**
+         * @return the number of submitted images.
+        */
+        size_t submitted() const;
+        /**
+         * @return the number of images dropped because the sink was behind (or
+         * had failed or was closed).
+        */
+        size_t dropped() const;
+    private:
+        struct Slot
+        {
+            uint32_t index;
+            cv::Mat image;
+            std::vector<DebugLayer> layers;
+            size_t count;
+        };
+        void run();
+        void render(Slot& slot);
+        std::string path;
+        DebugOutput output;
+        std::vector<std::string> layers;
+        double fps;
+        cv::VideoWriter writer;
+        cv::Mat canvas;
+        SpscQueue<Slot> free_slots;     // from the sink thread to the submitting thread
+        SpscQueue<Slot> queued_slots;   // from the submitting thread to the sink thread
+        size_t submitted_count;
+        size_t dropped_count;
+        std::exception_ptr error;
+        std::atomic<bool> failed;
+        std::atomic<bool> stop;
+        std::thread thread;
+};
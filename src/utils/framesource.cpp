@@ -0,0 +1,158 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdexcept>
+#include <algorithm>
+
+#include "framesource.hpp"
+
+
+static std::runtime_error system_error(std::string message)
+{
+    return std::runtime_error(message + ": " + strerror(errno));
+}
+
+
+MappedFrameSource::MappedFrameSource(std::string filename, cv::Size frame_size, int prefetch):
+    frame_size(frame_size), frame_bytes(frame_size.area()), next(0), prefetch(prefetch), data(nullptr), length(0)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw system_error("could not open '" + filename + "'");
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0)
+    {
+        close(fd);
+        throw system_error("could not stat '" + filename + "'");
+    }
+    this->frames = this->frame_bytes > 0 ? status.st_size/this->frame_bytes : 0;
+    this->length = this->frames*this->frame_bytes;
+    if (this->length > 0)
+    {
+        void *address = mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED)
+        {
+            close(fd);
+            throw system_error("could not map '" + filename + "'");
+        }
+        this->data = static_cast<unsigned char*>(address);
+        madvise(this->data, this->length, MADV_SEQUENTIAL);
+        this->advise(0, std::min(this->frames, (size_t)prefetch), MADV_WILLNEED);
+    }
+    close(fd); // the mapping keeps the file open
+}
+
+
+MappedFrameSource::~MappedFrameSource()
+{
+    if (this->data != nullptr)
+    {
+        munmap(this->data, this->length);
+    }
+}
+
+
+void MappedFrameSource::advise(size_t first, size_t last, int advice)
+{
+    // madvise works on whole pages
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    size_t begin = first*this->frame_bytes/page*page;
+    size_t end = std::min(last*this->frame_bytes, this->length);
+    if (end > begin)
+    {
+        madvise(this->data + begin, end - begin, advice);
+    }
+}
+
+
+bool MappedFrameSource::read(cv::Mat& frame)
+{
+    if (this->next >= this->frames)
+        return false;
+
+    // Prefetch the frame entering the window and release the frame before
+    // the previous one (the previous frame header may still be in use).
+    if (this->next + this->prefetch < this->frames)
+    {
+        this->advise(this->next + this->prefetch, this->next + this->prefetch + 1, MADV_WILLNEED);
+    }
+    if (this->next >= 2)
+    {
+        this->advise(this->next - 2, this->next - 1, MADV_DONTNEED);
+    }
+    frame = cv::Mat(this->frame_size, CV_8UC1, this->data + this->next*this->frame_bytes);
+    this->next++;
+    return true;
+}
+
+
+size_t MappedFrameSource::size() const
+{
+    return this->frames;
+}
+
+
+StreamFrameSource::StreamFrameSource(int fd, cv::Size frame_size, bool owned):
+    fd(fd), owned(owned), buffer(frame_size, CV_8UC1)
+{}
+
+
+StreamFrameSource::~StreamFrameSource()
+{
+    if (this->owned)
+    {
+        close(this->fd);
+    }
+}
+
+
+bool StreamFrameSource::read(cv::Mat& frame)
+{
+    size_t total = this->buffer.total(), count = 0;
+    while (count < total)
+    {
+        ssize_t n = ::read(this->fd, this->buffer.data + count, total - count);
+        if (n == 0)
+            break;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw system_error("could not read frame");
+        }
+        count += n;
+    }
+    if (count < total)
+        return false; // end of stream, a partial frame is dropped
+    frame = this->buffer;
+    return true;
+}
+
+
+std::unique_ptr<FrameSource> open_frame_source(std::string filename, cv::Size frame_size)
+{
+    if (filename == "-")
+    {
+        return std::unique_ptr<FrameSource>(new StreamFrameSource(STDIN_FILENO, frame_size));
+    }
+    struct stat status;
+    if (stat(filename.c_str(), &status) != 0)
+    {
+        throw system_error("could not open '" + filename + "'");
+    }
+    if (S_ISREG(status.st_mode))
+    {
+        return std::unique_ptr<FrameSource>(new MappedFrameSource(filename, frame_size));
+    }
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw system_error("could not open '" + filename + "'");
+    }
+    return std::unique_ptr<FrameSource>(new StreamFrameSource(fd, frame_size, true));
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/core/mat.hpp>
+
+
+/**
+ * @brief Source of fixed-size raw 8-bit gray frames stored one after the other
+ * (e.g. a raw video recording).
+*/
+class FrameSource
+{
+    public:
+        virtual ~FrameSource() {}
+        /**
+         * @brief Reads the next frame.
+         * @param frame: set to a header on the frame data, valid until the next
+         * call. Its content must not be modified.
+         * @return false at the end of the stream.
+        */
+        virtual bool read(cv::Mat& frame) = 0;
+};
+
+
+/**
+ * @brief Frame source memory-mapping a raw file: frames are handed out as
+ * headers pointing into the mapping, without copy. The pages of the next
+ * frames are prefetched and the pages of the previous frames are released, so
+ * that arbitrarily large files can be read sequentially with a bounded memory
+ * footprint.
+ * @param filename Raw file. Trailing bytes that don't make a full frame are
+ * ignored.
+ * @param frame_size Size of the frames
+ * @param prefetch Number of frames prefetched ahead of the current one
+*/
+class MappedFrameSource : public FrameSource
+{
+    public:
+        MappedFrameSource(std::string filename, cv::Size frame_size, int prefetch=4);
+        ~MappedFrameSource();
+        MappedFrameSource(const MappedFrameSource&) = delete;
+        MappedFrameSource& operator=(const MappedFrameSource&) = delete;
+        bool read(cv::Mat& frame);
+        /**
+         * @return the number of frames in the file.
+        */
+        size_t size() const;
+    private:
+        void advise(size_t first, size_t last, int advice);
+        cv::Size frame_size;
+        size_t frame_bytes;
+        size_t frames;
+        size_t next;
+        int prefetch;
+        unsigned char *data;
+        size_t length;
+};
+
+
+/**
+ * @brief Frame source reading a stream (e.g. stdin or a pipe) in a buffer
+ * allocated once: each frame overwrites the previous one.
+ * @param fd File descriptor of the stream
+ * @param frame_size Size of the frames
+ * @param owned If true, the file descriptor is closed with the source.
+*/
+class StreamFrameSource : public FrameSource
+{
+    public:
+        StreamFrameSource(int fd, cv::Size frame_size, bool owned=false);
+        ~StreamFrameSource();
+        StreamFrameSource(const StreamFrameSource&) = delete;
+        StreamFrameSource& operator=(const StreamFrameSource&) = delete;
+        bool read(cv::Mat& frame);
+    private:
+        int fd;
+        bool owned;
+        cv::Mat buffer;
+};
+
+
+/**
+ * @brief Opens a frame source: "-" reads stdin, regular files are
+ * memory-mapped and other files (pipes, devices) are read as streams.
+ * @param filename Raw file or "-"
+ * @param frame_size Size of the frames
+*/
+std::unique_ptr<FrameSource> open_frame_source(std::string filename, cv::Size frame_size);
@@ -0,0 +1,283 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <opencv2/viz/types.hpp>
+
+#include "lineexporter.hpp"
+
+
+// Size of a point in the binary columns: x, y, frame and line
+static const size_t point_size = 2*sizeof(float) + sizeof(uint32_t) + sizeof(uint8_t);
+
+
+static std::runtime_error system_error(std::string message)
+{
+    return std::runtime_error(message + ": " + strerror(errno));
+}
+
+
+/**
+ * Writes `value` in decimal at `output` and returns the end of the number.
+*/
+static char* format_unsigned(char *output, uint64_t value)
+{
+    char digits[20];
+    int count = 0;
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    while (count > 0)
+        *output++ = digits[--count];
+    return output;
+}
+
+/**
+ * Writes `value` with two decimals at `output` and returns the end of the
+ * number.
+*/
+static char* format_fixed(char *output, float value)
+{
+    if (value < 0)
+        *output++ = '-';
+    uint64_t hundredths = std::llround(std::abs(value)*100);
+    output = format_unsigned(output, hundredths/100);
+    *output++ = '.';
+    *output++ = '0' + hundredths/10 % 10;
+    *output++ = '0' + hundredths % 10;
+    return output;
+}
+
+static size_t padding(size_t size)
+{
+    return (4 - size % 4) % 4;
+}
+
+/**
+ * Converts `count` values of `size` bytes from the host byte order to
+ * little-endian, in place.
+*/
+static void to_little_endian(void *data, size_t count, size_t size)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    char *bytes = static_cast<char*>(data);
+    for (size_t i = 0; i < count; i++, bytes += size)
+        std::reverse(bytes, bytes + size);
+#else
+    (void)data; (void)count; (void)size;
+#endif
+}
+
+
+LineExporter::LineExporter(std::string filename, Court court, int steps, ExportFormat format, size_t buffer_size):
+    format(format), names(court.line_names()), text_size(0), points(0)
+{
+    // Line indices and name lengths are stored on one byte
+    if (this->names.size() > 255)
+    {
+        throw std::invalid_argument("cannot export more than 255 lines");
+    }
+    size_t longest = 0;
+    for (const std::string& name : this->names)
+    {
+        if (name.size() > 255)
+        {
+            throw std::invalid_argument("cannot export line '" + name.substr(0, 32) + "...': names are limited to 255 bytes");
+        }
+        longest = std::max(longest, name.size());
+    }
+    // Upper bound of the length of a CSV row: frame, line name and coordinates
+    this->max_row_size = 10 + 1 + longest + 1 + 16 + 1 + 16 + 1;
+
+    for (size_t line = 0; line < court.lines().size(); line++)
+    {
+        const std::vector<cv::Point3f>& endpoints = court.lines()[line];
+        for (int i = 0; i < steps; i++)
+        {
+            cv::Point3f point = endpoints[0] + (float)i/steps * (endpoints[1] - endpoints[0]);
+            this->x.push_back(point.x);
+            this->y.push_back(point.y);
+            this->z.push_back(point.z);
+            this->point_lines.push_back(line);
+        }
+    }
+    this->u.resize(this->x.size());
+    this->v.resize(this->x.size());
+
+    // The buffer holds at least one frame
+    if (format == csv_export)
+    {
+        this->capacity = std::max(buffer_size, this->x.size()*this->max_row_size);
+        this->text.resize(this->capacity);
+    }
+    else
+    {
+        this->capacity = std::max(buffer_size/point_size, this->x.size());
+        this->column_x.resize(this->capacity);
+        this->column_y.resize(this->capacity);
+        this->column_frame.resize(this->capacity);
+        this->column_line.resize(this->capacity);
+    }
+
+    this->fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (this->fd < 0)
+    {
+        throw system_error("could not open '" + filename + "'");
+    }
+
+    if (format == csv_export)
+    {
+        static const char header[] = "frame,line,x,y\n";
+        this->write(header, sizeof(header) - 1);
+    }
+    else
+    {
+        std::vector<char> header = {'C', 'D', 'L', 'X'};
+        uint32_t fields[] = {1, (uint32_t)this->names.size()};
+        to_little_endian(fields, 2, sizeof(uint32_t));
+        header.insert(header.end(), (char*)fields, (char*)(fields + 2));
+        for (const std::string& name : this->names)
+        {
+            header.push_back(name.size());
+            header.insert(header.end(), name.begin(), name.end());
+        }
+        header.resize(header.size() + padding(header.size()), 0);
+        this->write(header.data(), header.size());
+    }
+}
+
+
+LineExporter::~LineExporter()
+{
+    try
+    {
+        this->flush();
+    }
+    catch (std::exception& e) {} // destructors can't report the error
+    close(this->fd);
+}
+
+
+void LineExporter::write(const void *data, size_t size)
+{
+    const char *bytes = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        ssize_t n = ::write(this->fd, bytes, size);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw system_error("could not write lines");
+        }
+        bytes += n;
+        size -= n;
+    }
+}
+
+
+void LineExporter::flush()
+{
+    if (this->format == csv_export)
+    {
+        // The rows are dropped even if the write fails, not to be written
+        // twice by a retry or the destructor
+        size_t size = this->text_size;
+        this->text_size = 0;
+        this->write(this->text.data(), size);
+        return;
+    }
+    if (this->points == 0)
+        return;
+
+    // The columns are converted in place: they are dropped even if the write
+    // fails, not to be converted twice
+    uint32_t count = this->points, header = count;
+    this->points = 0;
+    to_little_endian(&header, 1, sizeof(header));
+    to_little_endian(this->column_x.data(), count, sizeof(float));
+    to_little_endian(this->column_y.data(), count, sizeof(float));
+    to_little_endian(this->column_frame.data(), count, sizeof(uint32_t));
+
+    // One block in a single call when the file accepts it all at once
+    static const char zeros[4] = {0, 0, 0, 0};
+    struct iovec parts[] = {
+        {&header, sizeof(header)},
+        {this->column_x.data(), count*sizeof(float)},
+        {this->column_y.data(), count*sizeof(float)},
+        {this->column_frame.data(), count*sizeof(uint32_t)},
+        {this->column_line.data(), count*sizeof(uint8_t)},
+        {(void*)zeros, padding(count)},
+    };
+    ssize_t n;
+    do
+    {
+        n = writev(this->fd, parts, 6);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+    {
+        throw system_error("could not write lines");
+    }
+    // Partial write: write what remains part by part
+    size_t written = n;
+    for (const struct iovec& part : parts)
+    {
+        if (written < part.iov_len)
+            this->write((const char*)part.iov_base + written, part.iov_len - written);
+        written -= std::min(written, part.iov_len);
+    }
+}
+
+
+void LineExporter::operator()(uint32_t frame, const Calib& calib, DebugLayer *debug_layer)
+{
+    size_t count = this->x.size();
+    calib.project(this->x.data(), this->y.data(), this->z.data(), count, this->u.data(), this->v.data());
+
+    float width = calib.image_size.width, height = calib.image_size.height;
+    for (size_t i = 0; i < count; i++)
+    {
+        // Also rejects the NaN of points behind the camera
+        float u = this->u[i], v = this->v[i];
+        if (!(u > 0 && u < width && v > 0 && v < height))
+            continue;
+
+        if (this->format == csv_export)
+        {
+            if (this->text_size + this->max_row_size > this->capacity)
+                this->flush();
+            const std::string& name = this->names[this->point_lines[i]];
+            char *output = this->text.data() + this->text_size;
+            output = format_unsigned(output, frame);
+            *output++ = ',';
+            output = std::copy(name.begin(), name.end(), output);
+            *output++ = ',';
+            output = format_fixed(output, u);
+            *output++ = ',';
+            output = format_fixed(output, v);
+            *output++ = '\n';
+            this->text_size = output - this->text.data();
+        }
+        else
+        {
+            if (this->points == this->capacity)
+                this->flush();
+            this->column_x[this->points] = u;
+            this->column_y[this->points] = v;
+            this->column_frame[this->points] = frame;
+            this->column_line[this->points] = this->point_lines[i];
+            this->points++;
+        }
+
+        if (debug_layer != nullptr)
+        {
+            debug_layer->point(cv::Point2f(u, v), 5, cv::viz::Color::red(), 2);
+        }
+    }
+}
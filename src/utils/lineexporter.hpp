@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <opencv2/core/mat.hpp>
+
+#include "utils.hpp"
+#include "court.hpp"
+#include "debuglayer.hpp"
+
+
+enum ExportFormat { csv_export, binary_export };
+
+
+/**
+ * @brief Exports the court lines projected with the calibration of each frame
+ * of a stream into a single file. The court lines are sampled once, each frame
+ * is projected in one batch, and the points inside the image are appended to a
+ * buffer written to the file when full (and on flush or destruction).
+ *
+ * The CSV format has a `frame,line,x,y` header and one row per point, the line
+ * being its name and the coordinates having two decimals.
+ *
+ * The binary format is little-endian (values are converted on big-endian
+ * hosts): a header with the magic "CDLX", the format version and the number of
+ * lines (uint32 each), followed by the name of each line (uint8 length and
+ * characters), zero-padded to a multiple of 4 bytes.
+ * Then come blocks of points, one per buffer write, in columns: the number of
+ * points n (uint32), x (float32[n]), y (float32[n]), frame (uint32[n]) and
+ * line index (uint8[n]), zero-padded to a multiple of 4 bytes. As indices and
+ * name lengths are stored on one byte, courts with more than 255 lines or
+ * with names longer than 255 bytes are rejected (std::invalid_argument).
+ * @param filename: output file, truncated
+ * @param court: court whose lines are exported, indexed as in Court::lines
+ * @param steps: number of points sampled along each line
+ * @param format: csv_export or binary_export
+ * @param buffer_size: number of bytes buffered between writes
+*/
+class LineExporter
+{
+    public:
+        LineExporter(std::string filename, Court court, int steps, ExportFormat format=csv_export, size_t buffer_size=1<<20);
+        ~LineExporter();
+        LineExporter(const LineExporter&) = delete;
+        LineExporter& operator=(const LineExporter&) = delete;
+        /**
+         * @brief Appends the court lines projected with `calib` for `frame`.
+         * @param debug_layer: if not null, the exported points are recorded in it.
+        */
+        void operator()(uint32_t frame, const Calib& calib, DebugLayer *debug_layer=nullptr);
+        /**
+         * @brief Writes the buffered points to the file. They are dropped
+         * from the buffer even if the write fails.
+         * @throws std::runtime_error if the file can't be written.
+        */
+        void flush();
+    private:
+        void write(const void *data, size_t size);
+        int fd;
+        ExportFormat format;
+        std::vector<std::string> names;
+        size_t capacity;
+        size_t max_row_size;
+        // Court points sampled along the lines and their projections
+        std::vector<float> x, y, z, u, v;
+        std::vector<uint8_t> point_lines;
+        // CSV text or binary columns waiting to be written
+        std::vector<char> text;
+        size_t text_size;
+        std::vector<float> column_x, column_y;
+        std::vector<uint32_t> column_frame;
+        std::vector<uint8_t> column_line;
+        size_t points;
+};
@@ -0,0 +1,171 @@
+#include <cmath>
+#include <limits>
+#include <cstdio>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include "metrics.hpp"
+
+
+// Bucket i covers [2^(e + s/16), 2^(e + (s+1)/16)) with e = i/16 + min_exponent
+// and s = i%16. Values below 2^min_exponent (including 0) fall in the first
+// bucket and values above 2^max_exponent in the last one.
+static const int sub_buckets = 16;
+static const int min_exponent = -20;
+static const int max_exponent = 44;
+
+
+static int bucket_index(double value)
+{
+    if (!(value > 0))
+        return 0;
+    int index = (int)std::floor((std::log2(value) - min_exponent)*sub_buckets);
+    return std::min(std::max(index, 0), (max_exponent - min_exponent)*sub_buckets - 1);
+}
+
+
+static double bucket_value(int index)
+{
+    // Geometric center of the bucket
+    return std::exp2(min_exponent + (index + 0.5)/sub_buckets);
+}
+
+
+Histogram::Histogram():
+    buckets((max_exponent - min_exponent)*sub_buckets, 0),
+    n(0),
+    total(0),
+    minimum(std::numeric_limits<double>::infinity()),
+    maximum(-std::numeric_limits<double>::infinity())
+{}
+
+void Histogram::record(double value)
+{
+    this->buckets[bucket_index(value)]++;
+    this->n++;
+    this->total += value;
+    this->minimum = std::min(this->minimum, value);
+    this->maximum = std::max(this->maximum, value);
+}
+
+size_t Histogram::count() const
+{
+    return this->n;
+}
+
+double Histogram::sum() const
+{
+    return this->total;
+}
+
+double Histogram::mean() const
+{
+    return this->n > 0 ? this->total/this->n : 0;
+}
+
+double Histogram::min() const
+{
+    return this->n > 0 ? this->minimum : 0;
+}
+
+double Histogram::max() const
+{
+    return this->n > 0 ? this->maximum : 0;
+}
+
+double Histogram::quantile(double q) const
+{
+    if (this->n == 0)
+        return 0;
+    uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(q*this->n));
+    uint64_t cumulated = 0;
+    size_t i = 0;
+    for (; i < this->buckets.size() - 1; i++)
+    {
+        cumulated += this->buckets[i];
+        if (cumulated >= rank)
+            break;
+    }
+    return std::min(std::max(bucket_value(i), this->minimum), this->maximum);
+}
+
+
+void Metrics::record(const std::string& name, double value)
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->entries[name].record(value);
+}
+
+std::map<std::string, Histogram> Metrics::histograms() const
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->entries;
+}
+
+void Metrics::reset()
+{
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->entries.clear();
+}
+
+std::string Metrics::to_json() const
+{
+    std::ostringstream stream;
+    stream << "{";
+    const char *separator = "\n";
+    for (const auto& entry : this->histograms())
+    {
+        const Histogram& histogram = entry.second;
+        stream << separator << "  \"" << entry.first << "\": {"
+               << "\"count\": " << histogram.count()
+               << ", \"mean\": " << histogram.mean()
+               << ", \"min\": " << histogram.min()
+               << ", \"max\": " << histogram.max()
+               << ", \"p50\": " << histogram.quantile(0.5)
+               << ", \"p99\": " << histogram.quantile(0.99) << "}";
+        separator = ",\n";
+    }
+    stream << "\n}\n";
+    return stream.str();
+}
+
+std::string Metrics::to_prometheus(const std::string& prefix) const
+{
+    std::ostringstream stream;
+    for (const auto& entry : this->histograms())
+    {
+        const Histogram& histogram = entry.second;
+        std::string name = prefix + "_" + entry.first;
+        stream << "# TYPE " << name << " summary\n"
+               << name << "{quantile=\"0.5\"} " << histogram.quantile(0.5) << "\n"
+               << name << "{quantile=\"0.99\"} " << histogram.quantile(0.99) << "\n"
+               << name << "_sum " << histogram.sum() << "\n"
+               << name << "_count " << histogram.count() << "\n";
+    }
+    return stream.str();
+}
+
+void Metrics::write(const std::string& path, MetricsFormat format, const std::string& prefix) const
+{
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary);
+        if (!file)
+        {
+            throw std::runtime_error("cannot write metrics to '" + temporary + "'");
+        }
+        file << (format == json_metrics ? this->to_json() : this->to_prometheus(prefix));
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        throw std::runtime_error("cannot write metrics to '" + path + "'");
+    }
+}
+
+
+double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
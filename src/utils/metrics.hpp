@@ -0,0 +1,86 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+
+/**
+ * @brief Histogram of positive values with logarithmic buckets (16 buckets per
+ * power of two, i.e. quantiles are estimated within ~2% of the recorded
+ * values). Recording a value is constant time and doesn't allocate.
+*/
+class Histogram
+{
+    public:
+        Histogram();
+        void record(double value);
+        size_t count() const;
+        double sum() const;
+        double mean() const;
+        double min() const;
+        double max() const;
+        /**
+         * @param q: quantile in [0, 1] (e.g. 0.99)
+         * @return the estimated quantile, or 0 if the histogram is empty.
+        */
+        double quantile(double q) const;
+    private:
+        std::vector<uint64_t> buckets;
+        size_t n;
+        double total;
+        double minimum;
+        double maximum;
+};
+
+
+enum MetricsFormat { json_metrics, prometheus_metrics };
+
+
+/**
+ * @brief Thread safe collection of named histograms, e.g. the latency of each
+ * operation of a module and the quantities it produces.
+*/
+class Metrics
+{
+    public:
+        /**
+         * @brief Records a value in the histogram `name`, created on first use.
+        */
+        void record(const std::string& name, double value);
+        /**
+         * @return a copy of all the histograms, by name.
+        */
+        std::map<std::string, Histogram> histograms() const;
+        /**
+         * @brief Removes all the histograms.
+        */
+        void reset();
+        /**
+         * @return the count, mean, min, max, p50 and p99 of each histogram as a
+         * JSON object.
+        */
+        std::string to_json() const;
+        /**
+         * @return the histograms as Prometheus summaries in text format.
+         * @param prefix: prefix of the metric names
+        */
+        std::string to_prometheus(const std::string& prefix) const;
+        /**
+         * @brief Writes the metrics to a file. The file is written next to its
+         * destination and renamed, so readers never see a partial file.
+        */
+        void write(const std::string& path, MetricsFormat format, const std::string& prefix) const;
+    private:
+        mutable std::mutex mutex;
+        std::map<std::string, Histogram> entries;
+};
+
+
+/**
+ * @return the time elapsed since `start` (in milliseconds).
+*/
+double elapsed_ms(std::chrono::steady_clock::time_point start);
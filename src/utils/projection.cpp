@@ -0,0 +1,185 @@
+#include <cmath>
+#include <limits>
+#include <opencv2/calib3d.hpp>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define AVX2_DISPATCH
+#endif
+
+#include "utils.hpp"
+
+
+// Number of points converted at once for the OpenCV functions, in stack arrays
+static const size_t chunk = 256;
+
+
+/**
+ * Applies the 3x4 matrix `m` (row-major) to the homogeneous points
+ * (x, y, z, 1) from index `begin`, z being 0 if null, and divides by the third
+ * coordinate. Points whose third coordinate isn't positive are set to NaN.
+*/
+static void transform_scalar(const float m[12], const float *x, const float *y, const float *z, size_t begin, size_t count, float *u, float *v)
+{
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    for (size_t i = begin; i < count; i++)
+    {
+        float zi = z != nullptr ? z[i] : 0;
+        float a = m[0]*x[i] + m[1]*y[i] + m[2]*zi + m[3];
+        float b = m[4]*x[i] + m[5]*y[i] + m[6]*zi + m[7];
+        float w = m[8]*x[i] + m[9]*y[i] + m[10]*zi + m[11];
+        float inverse = 1/w;
+        u[i] = w > 0 ? a*inverse : nan;
+        v[i] = w > 0 ? b*inverse : nan;
+    }
+}
+
+#ifdef AVX2_DISPATCH
+/**
+ * AVX2 version of transform_scalar, 8 points at a time. Returns the number of
+ * points transformed, the remaining ones (less than 8) are left to the scalar
+ * version.
+*/
+__attribute__((target("avx2,fma")))
+static size_t transform_avx2(const float m[12], const float *x, const float *y, const float *z, size_t count, float *u, float *v)
+{
+    __m256 M[12];
+    for (int k = 0; k < 12; k++)
+        M[k] = _mm256_set1_ps(m[k]);
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1);
+    const __m256 nan = _mm256_set1_ps(std::numeric_limits<float>::quiet_NaN());
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i);
+        __m256 a = _mm256_fmadd_ps(M[0], px, _mm256_fmadd_ps(M[1], py, M[3]));
+        __m256 b = _mm256_fmadd_ps(M[4], px, _mm256_fmadd_ps(M[5], py, M[7]));
+        __m256 w = _mm256_fmadd_ps(M[8], px, _mm256_fmadd_ps(M[9], py, M[11]));
+        if (z != nullptr)
+        {
+            __m256 pz = _mm256_loadu_ps(z + i);
+            a = _mm256_fmadd_ps(M[2], pz, a);
+            b = _mm256_fmadd_ps(M[6], pz, b);
+            w = _mm256_fmadd_ps(M[10], pz, w);
+        }
+        __m256 front = _mm256_cmp_ps(w, zero, _CMP_GT_OQ);
+        __m256 inverse = _mm256_div_ps(one, w);
+        _mm256_storeu_ps(u + i, _mm256_blendv_ps(nan, _mm256_mul_ps(a, inverse), front));
+        _mm256_storeu_ps(v + i, _mm256_blendv_ps(nan, _mm256_mul_ps(b, inverse), front));
+    }
+    return i;
+}
+#endif
+
+static void transform(const float m[12], const float *x, const float *y, const float *z, size_t count, float *u, float *v)
+{
+    size_t begin = 0;
+#ifdef AVX2_DISPATCH
+    static const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (avx2)
+        begin = transform_avx2(m, x, y, z, count, u, v);
+#endif
+    transform_scalar(m, x, y, z, begin, count, u, v);
+}
+
+
+static bool has_distortion(const cv::Mat& distCoeffs)
+{
+    return !distCoeffs.empty() && cv::norm(distCoeffs, cv::NORM_INF) > 0;
+}
+
+
+std::vector<cv::Point2f> Calib::project(const std::vector<cv::Point3f>& points3D) const
+{
+    std::vector<cv::Point2f> points2D(points3D.size());
+    if (has_distortion(this->distCoeffs))
+    {
+        cv::projectPoints(points3D, this->rvec, this->tvec, this->cameraMatrix, this->distCoeffs, points2D);
+        return points2D;
+    }
+    const double *p = this->P.ptr<double>(0);
+    for (size_t i = 0; i < points3D.size(); i++)
+    {
+        const cv::Point3f& q = points3D[i];
+        double w = p[8]*q.x + p[9]*q.y + p[10]*q.z + p[11];
+        points2D[i] = w > 0 ? cv::Point2f((p[0]*q.x + p[1]*q.y + p[2]*q.z + p[3])/w, (p[4]*q.x + p[5]*q.y + p[6]*q.z + p[7])/w)
+                            : cv::Point2f(NAN, NAN);
+    }
+    return points2D;
+}
+
+
+void Calib::project(const float *x, const float *y, const float *z, size_t count, float *u, float *v) const
+{
+    float m[12];
+    const double *p = this->P.ptr<double>(0);
+    for (int k = 0; k < 12; k++)
+        m[k] = p[k];
+    if (!has_distortion(this->distCoeffs))
+    {
+        transform(m, x, y, z, count, u, v);
+        return;
+    }
+
+    cv::Point3f object_points[chunk];
+    cv::Point2f image_points[chunk];
+    for (size_t begin = 0; begin < count; begin += chunk)
+    {
+        int n = std::min(chunk, count - begin);
+        for (int i = 0; i < n; i++)
+            object_points[i] = cv::Point3f(x[begin+i], y[begin+i], z != nullptr ? z[begin+i] : 0);
+        cv::Mat objects(n, 1, CV_32FC3, object_points), images(n, 1, CV_32FC2, image_points);
+        cv::projectPoints(objects, this->rvec, this->tvec, this->cameraMatrix, this->distCoeffs, images);
+        for (int i = 0; i < n; i++)
+        {
+            const cv::Point3f& q = object_points[i];
+            bool front = m[8]*q.x + m[9]*q.y + m[10]*q.z + m[11] > 0;
+            u[begin+i] = front ? image_points[i].x : NAN;
+            v[begin+i] = front ? image_points[i].y : NAN;
+        }
+    }
+}
+
+
+void Calib::back_project(const float *u, const float *v, size_t count, float *x, float *y) const
+{
+    // Inverse of the ground plane homography H = [p1 p2 p4], with its sign:
+    // the third coordinate is positive for points in front of the camera
+    const double *p = this->P.ptr<double>(0);
+    double H[9] = {p[0], p[1], p[3], p[4], p[5], p[7], p[8], p[9], p[11]};
+    double adjugate[9] = {
+        H[4]*H[8] - H[5]*H[7], H[2]*H[7] - H[1]*H[8], H[1]*H[5] - H[2]*H[4],
+        H[5]*H[6] - H[3]*H[8], H[0]*H[8] - H[2]*H[6], H[2]*H[3] - H[0]*H[5],
+        H[3]*H[7] - H[4]*H[6], H[1]*H[6] - H[0]*H[7], H[0]*H[4] - H[1]*H[3],
+    };
+    double determinant = H[0]*adjugate[0] + H[1]*adjugate[3] + H[2]*adjugate[6];
+    float m[12];
+    for (int row = 0; row < 3; row++)
+    {
+        m[4*row] = adjugate[3*row]/determinant;
+        m[4*row+1] = adjugate[3*row+1]/determinant;
+        m[4*row+2] = 0;
+        m[4*row+3] = adjugate[3*row+2]/determinant;
+    }
+    if (!has_distortion(this->distCoeffs))
+    {
+        transform(m, u, v, nullptr, count, x, y);
+        return;
+    }
+
+    cv::Point2f distorted[chunk], undistorted[chunk];
+    float uu[chunk], vv[chunk];
+    for (size_t begin = 0; begin < count; begin += chunk)
+    {
+        int n = std::min(chunk, count - begin);
+        for (int i = 0; i < n; i++)
+            distorted[i] = cv::Point2f(u[begin+i], v[begin+i]);
+        cv::Mat source(n, 1, CV_32FC2, distorted), destination(n, 1, CV_32FC2, undistorted);
+        cv::undistortPoints(source, destination, this->cameraMatrix, this->distCoeffs, cv::noArray(), this->cameraMatrix);
+        for (int i = 0; i < n; i++)
+        {
+            uu[i] = undistorted[i].x;
+            vv[i] = undistorted[i].y;
+        }
+        transform(m, uu, vv, nullptr, n, x + begin, y + begin);
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+
+/**
+ * @brief Bounded lock-free queue for a single producer thread and a single
+ * consumer thread. Items are moved in and out of a preallocated ring buffer.
+ * @param capacity Maximum number of items in the queue
+*/
+template<typename T>
+class SpscQueue
+{
+    public:
+        SpscQueue(size_t capacity):
+            buffer(capacity + 1), head(0), tail(0)
+        {}
+        /**
+         * @brief Pushes an item, moved from `item`. Must only be called by the
+         * producer thread.
+         * @return false if the queue is full (`item` is left untouched).
+        */
+        bool try_push(T& item)
+        {
+            size_t tail = this->tail.load(std::memory_order_relaxed);
+            size_t next = tail + 1 == this->buffer.size() ? 0 : tail + 1;
+            if (next == this->head.load(std::memory_order_acquire))
+                return false;
+            this->buffer[tail] = std::move(item);
+            this->tail.store(next, std::memory_order_release);
+            return true;
+        }
+        /**
+         * @brief Pops the oldest item into `item`. Must only be called by the
+         * consumer thread.
+         * @return false if the queue is empty.
+        */
+        bool try_pop(T& item)
+        {
+            size_t head = this->head.load(std::memory_order_relaxed);
+            if (head == this->tail.load(std::memory_order_acquire))
+                return false;
+            item = std::move(this->buffer[head]);
+            this->head.store(head + 1 == this->buffer.size() ? 0 : head + 1, std::memory_order_release);
+            return true;
+        }
+        /**
+         * @return the number of items in the queue (approximate when called
+         * concurrently with push or pop).
+        */
+        size_t size() const
+        {
+            size_t head = this->head.load(std::memory_order_acquire);
+            size_t tail = this->tail.load(std::memory_order_acquire);
+            return tail >= head ? tail - head : tail + this->buffer.size() - head;
+        }
+        /**
+         * @return the maximum number of items in the queue.
+        */
+        size_t capacity() const
+        {
+            return this->buffer.size() - 1;
+        }
+    private:
+        std::vector<T> buffer;
+        // Head and tail are kept on separate cache lines to avoid false sharing
+        std::atomic<size_t> head; // next item to pop, owned by the consumer
+        char padding[64];
+        std::atomic<size_t> tail; // next slot to push, owned by the producer
+};
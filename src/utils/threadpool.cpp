@@ -0,0 +1,119 @@
+#include <algorithm>
+
+#include "threadpool.hpp"
+
+
+// Pool and worker index of the current thread, if it's a worker thread
+static thread_local const ThreadPool *current_pool = nullptr;
+static thread_local int current_worker = -1;
+
+
+ThreadPool::ThreadPool(int num_threads):
+    pending(0), next(0), stop(false)
+{
+    if (num_threads <= 0)
+    {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (int i = 0; i < num_threads; i++)
+    {
+        this->workers.emplace_back(new Worker());
+    }
+    for (int i = 0; i < num_threads; i++)
+    {
+        this->threads.emplace_back(&ThreadPool::run, this, i);
+    }
+}
+
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stop = true;
+    }
+    this->condition.notify_all();
+    for (std::thread& thread : this->threads)
+    {
+        thread.join();
+    }
+}
+
+
+int ThreadPool::size() const
+{
+    return this->workers.size();
+}
+
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    int index = current_pool == this ? current_worker : this->next++ % this->workers.size();
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->pending++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->workers[index]->mutex);
+        this->workers[index]->tasks.push_back(std::move(task));
+    }
+    this->condition.notify_one();
+}
+
+
+bool ThreadPool::pop(int index, std::function<void()>& task)
+{
+    // Own queue first, most recent task first
+    {
+        Worker& worker = *this->workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.tasks.empty())
+        {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+            return true;
+        }
+    }
+
+    // Steal the oldest task of another worker
+    int num_workers = this->workers.size();
+    for (int i = 1; i < num_workers; i++)
+    {
+        Worker& victim = *this->workers[(index + i) % num_workers];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void ThreadPool::run(int index)
+{
+    current_pool = this;
+    current_worker = index;
+    std::function<void()> task;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->condition.wait(lock, [this] { return this->stop || this->pending > 0; });
+            if (this->pending == 0)
+                return; // stopped and no task left
+        }
+        if (this->pop(index, task))
+        {
+            this->pending--;
+            task();
+            task = nullptr;
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+
+/**
+ * @brief Work-stealing thread pool. Each worker owns a queue of tasks: it
+ * executes its own tasks first (most recent first) and steals the oldest tasks
+ * of other workers when its queue is empty. Tasks submitted from a worker go to
+ * that worker's queue, other tasks are distributed in round robin.
+ * @param num_threads Number of worker threads. If 0, the number of hardware
+ * threads is used.
+*/
+class ThreadPool
+{
+    public:
+        ThreadPool(int num_threads=0);
+        /**
+         * @brief Waits for all submitted tasks to complete and stops the
+         * workers.
+        */
+        ~ThreadPool();
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        /**
+         * @brief Schedules a task for execution on one of the workers.
+        */
+        void submit(std::function<void()> task);
+        /**
+         * @return the number of worker threads.
+        */
+        int size() const;
+    private:
+        struct Worker
+        {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+        void run(int index);
+        bool pop(int index, std::function<void()>& task);
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::atomic<int> pending;
+        std::atomic<unsigned> next;
+        bool stop;
+};
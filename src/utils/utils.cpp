@@ -1,6 +1,5 @@
 #include <math.h>
-#include <fstream>
-#include <iostream>
+#include <algorithm>
 
 #include <opencv2/calib3d.hpp>
 
@@ -8,20 +7,147 @@
 
 
 Calib::Calib(cv::Mat cameraMatrix, cv::Mat distCoeffs, cv::Mat rvec, cv::Mat tvec, cv::Size image_size):
-    cameraMatrix(cameraMatrix), distCoeffs(distCoeffs), rvec(rvec), tvec(tvec), image_size(image_size)
+    cameraMatrix(cameraMatrix.clone()), distCoeffs(distCoeffs.clone()), rvec(rvec.clone()), tvec(tvec.clone()), image_size(image_size)
 {
-    cv::Mat R, RT;
-    cv::Rodrigues(rvec, R);
-    cv::hconcat(R, tvec, RT);
-    this->P = cameraMatrix * RT;
+    this->update_projection();
 }
 
 
-std::vector<cv::Point2f> Calib::project(std::vector<cv::Point3f> points3D)
+Calib::Calib():
+    cameraMatrix(cv::Mat::eye(3, 3, CV_64F)), distCoeffs(cv::Mat::zeros(1, 5, CV_64F)),
+    rvec(cv::Mat::zeros(3, 1, CV_64F)), tvec(cv::Mat::zeros(3, 1, CV_64F)), image_size(0, 0)
 {
-    std::vector<cv::Point2f> points2D;
-    cv::projectPoints(points3D, this->rvec, this->tvec, this->cameraMatrix, this->distCoeffs, points2D);
-    return points2D;
+    this->update_projection();
+}
+
+
+Calib::Calib(const Calib& calib):
+    image_size(calib.image_size), P(calib.P.clone()), cameraMatrix(calib.cameraMatrix.clone()),
+    distCoeffs(calib.distCoeffs.clone()), rvec(calib.rvec.clone()), tvec(calib.tvec.clone())
+{}
+
+
+Calib& Calib::operator=(const Calib& calib)
+{
+    calib.copyTo(*this);
+    return *this;
+}
+
+
+void Calib::update(cv::Mat cameraMatrix, cv::Mat distCoeffs, cv::Mat rvec, cv::Mat tvec, cv::Size image_size)
+{
+    cameraMatrix.copyTo(this->cameraMatrix);
+    distCoeffs.copyTo(this->distCoeffs);
+    rvec.copyTo(this->rvec);
+    tvec.copyTo(this->tvec);
+    this->image_size = image_size;
+    this->update_projection();
+}
+
+
+void Calib::copyTo(Calib& calib) const
+{
+    if (&calib == this)
+        return;
+    calib.update(this->cameraMatrix, this->distCoeffs, this->rvec, this->tvec, this->image_size);
+}
+
+
+const cv::Mat& Calib::camera_matrix() const
+{
+    return this->cameraMatrix;
+}
+
+
+const cv::Mat& Calib::distortion_coefficients() const
+{
+    return this->distCoeffs;
+}
+
+
+const cv::Mat& Calib::rotation_vector() const
+{
+    return this->rvec;
+}
+
+
+const cv::Mat& Calib::translation_vector() const
+{
+    return this->tvec;
+}
+
+
+void Calib::update_projection()
+{
+    // P = K [R|t], computed in the existing buffer
+    double r[9];
+    cv::Mat R(3, 3, CV_64F, r);
+    cv::Rodrigues(this->rvec, R);
+    cv::Mat_<double> K = this->cameraMatrix, t = this->tvec;
+    this->P.create(3, 4, CV_64F);
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            double value = 0;
+            for (int k = 0; k < 3; k++)
+                value += K(i, k)*(j < 3 ? r[k*3 + j] : t(k));
+            this->P.at<double>(i, j) = value;
+        }
+    }
+}
+
+
+DisjointSet::DisjointSet(int size)
+{
+    this->reset(size);
+}
+
+
+void DisjointSet::reset(int size)
+{
+    this->parent.resize(size);
+    this->rank.assign(size, 0);
+    for (int i = 0; i < size; i++)
+        this->parent[i] = i;
+}
+
+
+int DisjointSet::add()
+{
+    int element = this->parent.size();
+    this->parent.push_back(element);
+    this->rank.push_back(0);
+    return element;
+}
+
+
+int DisjointSet::find(int element)
+{
+    int root = element;
+    while (this->parent[root] != root)
+        root = this->parent[root];
+    while (this->parent[element] != root)
+    {
+        int next = this->parent[element];
+        this->parent[element] = root;
+        element = next;
+    }
+    return root;
+}
+
+
+void DisjointSet::merge(int a, int b)
+{
+    a = this->find(a);
+    b = this->find(b);
+    if (a == b)
+        return;
+    if (this->rank[a] < this->rank[b])
+        std::swap(a, b);
+    this->parent[b] = a;
+    if (this->rank[a] == this->rank[b])
+        this->rank[a]++;
 }
 
 
@@ -40,14 +166,14 @@ LineSegment::LineSegment(float x1, float y1, float x2, float y2):
 }
 
 
-float LineSegment::distance_to(cv::Point2f point)
+float LineSegment::distance_to(cv::Point2f point) const
 {
     cv::Point2f closest = closest_point(this->rho, this->theta, point);
     return cv::norm(point - closest);
 }
 
 
-cv::Point2f LineSegment::intersect_with(LineSegment line)
+cv::Point2f LineSegment::intersect_with(LineSegment line) const
 {
     /* Find the intersection point of two lines
     */
@@ -68,49 +194,48 @@ cv::Point2f closest_point(float rho, float theta, cv::Point2f point)
 }
 
 
-void draw_line(LineSegment line, cv::Mat &output, cv::viz::Color color, int thickness, int markersize, std::string label)
+LineSegment fit_line(const std::vector<cv::Point2f>& points, const std::vector<float>& weights)
 {
-    cv::line(output, cv::Point(line.x1, line.y1), cv::Point(line.x2, line.y2), color, thickness);
-    cv::circle(output, cv::Point(line.x1, line.y1), markersize, color, -1);
-    cv::circle(output, cv::Point(line.x2, line.y2), markersize, color, -1);
-    int x = (line.x1 + line.x2)/2, y = (line.y1 + line.y2)/2;
-    cv::putText(output, label, cv::Point(x, y), cv::FONT_HERSHEY_SIMPLEX, 1, color, thickness);
-}
-
-
-void draw_line_projected(Calib calib, cv::Point3f p1, cv::Point3f p2, cv::Mat &output, cv::viz::Color color, int thickness, int markersize, std::string label)
-{
-    std::vector<cv::Point3f> points3D = {p1, p2};
-    std::vector<cv::Point2f> points2D = calib.project(points3D);
-    cv::Point2f p12D = points2D[0], p22D = points2D[1];
-    draw_line(LineSegment(p12D.x, p12D.y, p22D.x, p22D.y), output, color, thickness, markersize, label);
-}
-
-
-void write_line(std::string filename, Calib calib, std::vector<cv::Point3f> line, int steps, cv::Mat *debug_image)
-{
-    std::ofstream filestream;
-    filestream.open(filename);
+    // Weighted centroid
+    double sw = 0, mx = 0, my = 0;
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        sw += weights[i];
+        mx += weights[i]*points[i].x;
+        my += weights[i]*points[i].y;
+    }
+    mx /= sw;
+    my /= sw;
 
-    std::vector<cv::Point3f> points3D(steps);
-    std::vector<cv::Point2f> points2D(steps);
-    for (int i = 0; i < steps; i++)
+    // Principal axis of the weighted covariance gives the line direction
+    double sxx = 0, sxy = 0, syy = 0;
+    for (size_t i = 0; i < points.size(); i++)
     {
-        points3D[i] = line[0] + (float)i/steps * (line[1] - line[0]);
+        double dx = points[i].x - mx, dy = points[i].y - my;
+        sxx += weights[i]*dx*dx;
+        sxy += weights[i]*dx*dy;
+        syy += weights[i]*dy*dy;
     }
-    points2D = calib.project(points3D);
-    for (cv::Point2f point : points2D)
+    double angle = 0.5*atan2(2*sxy, sxx - syy);
+    double ux = cos(angle), uy = sin(angle);
+
+    // Segment extremities are the extreme points projected on the line
+    double tmin = 0, tmax = 0;
+    for (size_t i = 0; i < points.size(); i++)
     {
-        if (point.x > 0 && point.x < calib.image_size.width && point.y > 0 && point.y < calib.image_size.height)
-        {
-            filestream << point.x << "," << point.y << std::endl;
-            if (debug_image != nullptr)
-            {
-                cv::circle(*debug_image, point, 5, cv::viz::Color::red(), 2);
-            }
-        }
+        double t = (points[i].x - mx)*ux + (points[i].y - my)*uy;
+        tmin = std::min(tmin, t);
+        tmax = std::max(tmax, t);
     }
-    filestream.close();
+    return LineSegment(mx + tmin*ux, my + tmin*uy, mx + tmax*ux, my + tmax*uy);
+}
 
-    std::cout << filename << " written" << std::endl;
+
+void draw_line(LineSegment line, cv::Mat &output, cv::Scalar color, int thickness, int markersize, std::string label)
+{
+    cv::line(output, cv::Point(line.x1, line.y1), cv::Point(line.x2, line.y2), color, thickness);
+    cv::circle(output, cv::Point(line.x1, line.y1), markersize, color, -1);
+    cv::circle(output, cv::Point(line.x2, line.y2), markersize, color, -1);
+    int x = (line.x1 + line.x2)/2, y = (line.y1 + line.y2)/2;
+    cv::putText(output, label, cv::Point(x, y), cv::FONT_HERSHEY_SIMPLEX, 1, color, thickness);
 }
@@ -41,7 +41,8 @@ const std::vector<cv::viz::Color> colors = {
 
 
 /**
- * @brief Class representing a calibration
+ * @brief Class representing a calibration. Copies are deep: they don't share
+ * the matrices buffers, which are updated in place.
  * @param cameraMatrix Camera intrinsic parameters
  * @param distCoeffs Lens distortion coefficients
  * @param rvec Rotation vector expressed from the world coordinate system to
@@ -52,17 +53,108 @@ const std::vector<cv::viz::Color> colors = {
 class Calib
 {
     public:
+        /**
+         * @brief The matrices are copied.
+        */
         Calib(cv::Mat cameraMatrix, cv::Mat distCoeffs, cv::Mat rvec, cv::Mat tvec, cv::Size image_size);
-        std::vector<cv::Point2f> project(std::vector<cv::Point3f> point3D);
+        /**
+         * @brief Identity camera at the world origin, meant to be overwritten
+         * with update or copyTo.
+        */
+        Calib();
+        Calib(const Calib& calib);
+        Calib(Calib&& calib) = default;
+        /**
+         * @brief Copies the parameters in the existing buffers (see copyTo).
+        */
+        Calib& operator=(const Calib& calib);
+        Calib& operator=(Calib&& calib) = default;
+        /**
+         * @brief Projects 3D world points in the image (see the batched
+         * version).
+        */
+        std::vector<cv::Point2f> project(const std::vector<cv::Point3f>& points3D) const;
+        /**
+         * @brief Projects 3D world points given as arrays of coordinates
+         * (structure of arrays). Without lens distortion, the points are
+         * projected with P in single precision, 8 at a time on CPUs with AVX2
+         * and FMA (detected at runtime); otherwise with cv::projectPoints.
+         * Points behind the camera are projected to NaN.
+         * @param x, y, z: world coordinates of the points. z may be null for
+         * points on the ground plane (z=0).
+         * @param count: number of points
+         * @param u, v: output image coordinates (may not overlap the input)
+        */
+        void project(const float *x, const float *y, const float *z, size_t count, float *u, float *v) const;
+        /**
+         * @brief Back-projects image points on the ground plane (z=0) with the
+         * inverse of the homography made of the columns 1, 2 and 4 of P (the
+         * image points are undistorted first when there is lens distortion).
+         * Points above the horizon are back-projected to NaN.
+         * @param u, v: image coordinates of the points
+         * @param count: number of points
+         * @param x, y: output world coordinates (may not overlap the input)
+        */
+        void back_project(const float *u, const float *v, size_t count, float *x, float *y) const;
+        /**
+         * @brief Replaces the parameters in place: the matrices are copied in
+         * the existing buffers, which aren't reallocated if they have the same
+         * size.
+        */
+        void update(cv::Mat cameraMatrix, cv::Mat distCoeffs, cv::Mat rvec, cv::Mat tvec, cv::Size image_size);
+        /**
+         * @brief Copies the parameters into `calib` (see update).
+        */
+        void copyTo(Calib& calib) const;
+        /**
+         * @return the parameters given to the constructor or to update.
+        */
+        const cv::Mat& camera_matrix() const;
+        const cv::Mat& distortion_coefficients() const;
+        const cv::Mat& rotation_vector() const;
+        const cv::Mat& translation_vector() const;
         cv::Size image_size;
         cv::Mat P;
     private:
+        void update_projection();
         cv::Mat cameraMatrix;
         cv::Mat distCoeffs;
         cv::Mat rvec;
         cv::Mat tvec;
 };
 
+/**
+ * @brief Disjoint set (union-find) structure over the integers [0, size[ with
+ * path compression and union by rank.
+ * @param size Number of elements
+*/
+class DisjointSet
+{
+    public:
+        DisjointSet(int size=0);
+        /**
+         * @brief Resets the structure to `size` singletons.
+        */
+        void reset(int size);
+        /**
+         * @brief Adds a singleton.
+         * @return the new element.
+        */
+        int add();
+        /**
+         * @brief Finds the representative of the set containing `element`.
+        */
+        int find(int element);
+        /**
+         * @brief Merges the sets containing `a` and `b`.
+        */
+        void merge(int a, int b);
+    private:
+        std::vector<int> parent;
+        std::vector<int> rank;
+};
+
+
 enum LineOrientation { horizontal, vertical };
 
 
@@ -77,8 +169,8 @@ class LineSegment
 {
     public:
         LineSegment(float x1, float y1, float x2, float y2);
-        float distance_to(cv::Point2f point);
-        cv::Point2f intersect_with(LineSegment line);
+        float distance_to(cv::Point2f point) const;
+        cv::Point2f intersect_with(LineSegment line) const;
         float x1, y1, x2, y2;
         float rho;
         float theta;
@@ -99,38 +191,24 @@ cv::Point2f closest_point(float rho, float theta, cv::Point2f point);
 
 
 /**
- * @brief Draw a line in an image, given the 2D coordinates of its extremities
- * @param line Line to draw
- * @param output Image in which the line is drawn
- * @param color Color of the line (RGB)
- * @param thickness Thickness of the line
- * @param markersize Size of the markers at the extremities
- * @param label Label written at the middle of the line
+ * @brief Fits a line to weighted 2D points by total least squares. The
+ * returned segment spans the extent of the points along the fitted line.
+ * @param points Points to which the line is fitted (at least 2)
+ * @param weights Weight of each point
+ * @return Fitted line segment
 */
-void draw_line(LineSegment line, cv::Mat &output, cv::viz::Color color, int thickness=2, int markersize=5, std::string label="");
+LineSegment fit_line(const std::vector<cv::Point2f>& points, const std::vector<float>& weights);
 
 
 /**
- * @brief Draw a line in an image, given the 3D coordinates of its extremities
- * @param calib Current calibration object
- * @param p1 One line extremity
- * @param p2 Other line extremity
+ * @brief Draw a line in an image, given the 2D coordinates of its extremities
+ * @param line Line to draw
  * @param output Image in which the line is drawn
  * @param color Color of the line (RGB)
  * @param thickness Thickness of the line
  * @param markersize Size of the markers at the extremities
  * @param label Label written at the middle of the line
 */
-void draw_line_projected(Calib calib, cv::Point3f p1, cv::Point3f p2, cv::Mat &output, cv::viz::Color color, int thickness, int markersize, std::string label);
+void draw_line(LineSegment line, cv::Mat &output, cv::Scalar color, int thickness=2, int markersize=5, std::string label="");
 
 
-/**
- * @brief Write point coordinates of a line to a csv file. Points are uniformly
- * sampled along the line.
- * @param filename File in which the line is written
- * @param calib Current calibration object
- * @param line Pair of points defining the line extremities in the 3D world
- * @param steps Number of points to sample along the (3D) line
- * @param debug_image Optional debug image
-*/
-void write_line(std::string filename, Calib calib, std::vector<cv::Point3f> line, int steps, cv::Mat *debug_image=nullptr);
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <chrono>
+#include <limits>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+#include <utils.hpp>
+#include <court.hpp>
+#include <metrics.hpp>
+#include <synthetic.hpp>
+#include <courtdetector.hpp>
+#include <opencv2/opencv.hpp>
+#include <boost/program_options.hpp>
+
+
+/**
+ * Runs the detection on `frames` synthetic images downscaled by `scale` (with
+ * `pyramid_levels` more levels in the detector, see CourtDetector) and prints
+ * a point of the accuracy-vs-latency curve: the latency (including the
+ * downscaling) and the distance between the detected and ground truth
+ * calibrations in the original image. Images are generated on the fly, or
+ * generated once and cycled over when `cache` > 0 to measure the detection
+ * throughput alone.
+*/
+static void evaluate(Court court, cv::Size image_size, SyntheticParameters parameters, unsigned seed, int cache, int frames, double scale, bool tracking, LineTracking line_tracking, int pyramid_levels, int threshold, int contrast, double max_error)
+{
+    SyntheticGenerator generate(court, image_size, parameters, seed);
+    std::vector<cv::Mat> images(cache);
+    std::vector<Calib> calibs;
+    for (cv::Mat& image : images)
+        calibs.push_back(generate(image));
+
+    cv::Size size(cvRound(image_size.width*scale), cvRound(image_size.height*scale));
+    CourtDetector detector(court, size, false, tracking, line_tracking, pyramid_levels, threshold, contrast);
+    // Maps pixel centers of the downscaled image to the original image
+    cv::Mat A = (cv::Mat_<double>(3, 3) << 1/scale, 0, 0.5/scale - 0.5,
+                                           0, 1/scale, 0.5/scale - 0.5,
+                                           0, 0, 1);
+    Histogram latency, error;
+    int failures = 0;
+    cv::Mat generated, resized;
+    for (int i = 0; i < frames; i++)
+    {
+        cv::Mat image, truth;
+        if (cache > 0)
+        {
+            image = images[i % cache];
+            truth = calibs[i % cache].P;
+        }
+        else
+        {
+            truth = generate(generated).P;
+            image = generated;
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        double distance = std::numeric_limits<double>::infinity();
+        try
+        {
+            if (scale != 1)
+                cv::resize(image, resized, size, 0, 0, cv::INTER_AREA);
+            else
+                resized = image;
+            Calib calib = detector(resized);
+            latency.record(elapsed_ms(start));
+            distance = reprojection_distance(court, truth, A*calib.P, image_size);
+        }
+        catch (std::exception& e)
+        {
+            latency.record(elapsed_ms(start));
+        }
+        if (!(distance <= max_error))
+        {
+            failures++;
+            detector.reset();
+        }
+        else
+        {
+            error.record(distance);
+        }
+    }
+    std::cout << scale << "," << size.width << "," << size.height << "," << frames << "," << failures << ","
+              << latency.mean() << "," << latency.quantile(0.99) << ","
+              << error.quantile(0.5) << "," << error.quantile(0.99) << std::endl;
+}
+
+
+int main(int argc, char *argv[])
+{
+    boost::program_options::options_description desc("Generates synthetic tennis court images with their ground truth calibration.\nOptions");
+    desc.add_options()
+        ("help,h", "produce help message")
+        ("width", boost::program_options::value<int>()->default_value(1280), "Image width")
+        ("height", boost::program_options::value<int>()->default_value(720), "Image height")
+        ("frames", boost::program_options::value<int>()->default_value(100), "Number of images")
+        ("seed", boost::program_options::value<unsigned>()->default_value(0), "Random seed")
+        ("rule-type", boost::program_options::value<std::string>()->default_value("ITF"), "Rule type describing the court: 'ITF' (tennis), 'padel', 'badminton' or 'pickleball'")
+        ("noise", boost::program_options::value<float>()->default_value(broadcast_camera.noise), "Standard deviation of the background noise (gray levels)")
+        ("blur", boost::program_options::value<float>()->default_value(broadcast_camera.blur_max), "Maximum standard deviation of the gaussian blur (pixels)")
+        ("distractors", boost::program_options::value<int>()->default_value(broadcast_camera.distractors), "Number of distractor line segments per image")
+        ("clutter", boost::program_options::value<int>()->default_value(broadcast_camera.clutter), "Number of bright spots per image")
+        ("output", boost::program_options::value<std::string>(), "Writes the images to <output>.raw (raw 8-bit images, one after the other) and their projection matrices to <output>.csv")
+        ("cache", boost::program_options::value<int>()->default_value(0), "Number of distinct images generated before detection and cycled over (0: one per frame)")
+        ("detect", "Runs the court detection on the images and prints the accuracy-vs-latency curve as csv")
+        ("scales", boost::program_options::value<std::string>()->default_value("1"), "Comma separated scales at which images are downscaled before detection, one curve point each")
+        ("tracking", "Tracks the lines between consecutive images during detection")
+        ("hough-tracking", "Tracks the lines with a Hough transform restricted to each line (implies --tracking)")
+        ("pyramid-levels", boost::program_options::value<int>()->default_value(0), "Number of times the images are halved in the detector before the full detection")
+        ("threshold", boost::program_options::value<int>()->default_value(128), "Minimum gray level of line pixels in the detector")
+        ("contrast", boost::program_options::value<int>()->default_value(20), "Minimum difference between line pixels and the pixels on both sides of the line in the detector")
+        ("max-error", boost::program_options::value<double>()->default_value(5), "Reprojection distance (in pixels) above which a detection is counted as failed")
+    ;
+
+    boost::program_options::variables_map vm;
+    try
+    {
+        boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+        boost::program_options::notify(vm);
+    }
+    catch(std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    if (vm.count("help"))
+    {
+        std::cout << desc << std::endl;
+        return 0;
+    }
+
+    cv::Size image_size(vm["width"].as<int>(), vm["height"].as<int>());
+    int frames = vm["frames"].as<int>();
+    int cache = vm["cache"].as<int>();
+    SyntheticParameters parameters = broadcast_camera;
+    parameters.noise = vm["noise"].as<float>();
+    parameters.blur_max = vm["blur"].as<float>();
+    parameters.distractors = vm["distractors"].as<int>();
+    parameters.clutter = vm["clutter"].as<int>();
+    std::string rule_type = vm["rule-type"].as<std::string>();
+    std::vector<std::string> rule_types = Court::rule_types();
+    if (std::find(rule_types.begin(), rule_types.end(), rule_type) == rule_types.end())
+    {
+        std::cerr << "Error: unknown rule type '" << rule_type << "'" << std::endl;
+        return 1;
+    }
+    Court court(rule_type);
+    unsigned seed = vm["seed"].as<unsigned>();
+
+    if (vm.count("output"))
+    {
+        std::string output = vm["output"].as<std::string>();
+        FILE *raw = fopen((output + ".raw").c_str(), "wb");
+        std::ofstream csv(output + ".csv");
+        if (raw == nullptr || !csv)
+        {
+            std::cerr << "Error: could not open '" << output << "' files for writing\n";
+            return 1;
+        }
+        csv << std::setprecision(17);
+
+        SyntheticGenerator generate(court, image_size, parameters, seed);
+        cv::Mat image;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool written = true;
+        for (int i = 0; i < frames && written; i++)
+        {
+            Calib calib = generate(image);
+            written = std::fwrite(image.data, image.total(), 1, raw) == 1;
+            csv << i;
+            for (int k = 0; k < 12; k++)
+                csv << "," << calib.P.at<double>(k/4, k%4);
+            csv << "\n";
+        }
+        double elapsed = elapsed_ms(start);
+        // A truncated dataset must not look complete: every write is checked
+        written = fclose(raw) == 0 && written;
+        if (!written || !csv.flush())
+        {
+            std::cerr << "Error: could not write '" << output << (written ? ".csv" : ".raw") << "': " << strerror(errno) << std::endl;
+            return 1;
+        }
+        std::cerr << "Wrote " << frames << " images in " << elapsed << " ms (" << 1000*frames/elapsed << " images/s)\n";
+    }
+
+    if (vm.count("detect"))
+    {
+        // The same seed generates the same images for all the scales
+        std::cout << "scale,width,height,frames,failures,latency_mean_ms,latency_p99_ms,error_p50_px,error_p99_px" << std::endl;
+        std::stringstream scales(vm["scales"].as<std::string>());
+        std::string scale;
+        bool tracking = vm.count("tracking") || vm.count("hough-tracking");
+        LineTracking line_tracking = vm.count("hough-tracking") ? hough_tracking : profile_tracking;
+        try
+        {
+            while (std::getline(scales, scale, ','))
+            {
+                evaluate(court, image_size, parameters, seed, std::min(cache, frames), frames, std::stod(scale), tracking, line_tracking, vm["pyramid-levels"].as<int>(), vm["threshold"].as<int>(), vm["contrast"].as<int>(), vm["max-error"].as<double>());
+            }
+        }
+        catch(std::exception& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}